@@ -0,0 +1,528 @@
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <linux/magic.h>
+#include <linux/perf_event.h>
+#include <memory>
+#include <new>
+#include <random>
+#include <span>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "codec.h"
+#include "dbwrapper.h"
+#include "mdbx.h"
+#include "util.h"
+
+// Microbenchmarks for the serialization and wrapper layers. Each case reports
+// nanoseconds, heap allocations and retired instructions per operation.
+
+//
+// Allocation counting
+//
+
+static std::atomic<uint64_t> g_allocs{0};
+
+void* operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+//
+// Instruction counting
+//
+
+/** Counts user-space instructions retired by this thread, where perf events are permitted */
+class InstructionCounter
+{
+private:
+    int m_fd{-1};
+
+public:
+    InstructionCounter()
+    {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1, /*group_fd=*/-1, /*flags=*/0);
+    }
+    ~InstructionCounter() { if (m_fd >= 0) close(m_fd); }
+
+    bool Available() const { return m_fd >= 0; }
+
+    void Start()
+    {
+        if (!Available()) return;
+        ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t Stop()
+    {
+        uint64_t count{0};
+        if (!Available()) return count;
+        ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(m_fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+        return count;
+    }
+};
+
+static InstructionCounter g_instructions;
+
+//
+// Harness
+//
+
+// Keep the compiler from optimizing away a result that is otherwise unused.
+template <typename T>
+static void DoNotOptimize(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+template <typename Fn>
+static void Bench(const std::string& name, uint64_t iters, Fn&& fn)
+{
+    // Warm up caches and let containers reach their steady-state capacity.
+    for (uint64_t i = 0; i < iters / 10; i++) fn(i);
+
+    const uint64_t allocs_start{g_allocs.load(std::memory_order_relaxed)};
+    g_instructions.Start();
+    const auto start{std::chrono::steady_clock::now()};
+    for (uint64_t i = 0; i < iters; i++) fn(i);
+    const auto elapsed{std::chrono::steady_clock::now() - start};
+    const uint64_t instructions{g_instructions.Stop()};
+    const uint64_t allocs{g_allocs.load(std::memory_order_relaxed) - allocs_start};
+
+    std::cout << std::left << std::setw(36) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << std::chrono::duration<double, std::nano>(elapsed).count() / iters
+              << std::setw(12) << static_cast<double>(allocs) / iters;
+    if (g_instructions.Available()) {
+        std::cout << std::setw(14) << static_cast<double>(instructions) / iters;
+    } else {
+        std::cout << std::setw(14) << "n/a";
+    }
+    std::cout << std::endl;
+}
+
+static constexpr size_t KEY_SIZE{32};
+static constexpr size_t VALUE_SIZE{40};
+using Key = std::array<std::byte, KEY_SIZE>;
+using Value = std::array<std::byte, VALUE_SIZE>;
+
+// util.h serializes dynamic-extent spans as raw bytes.
+template <typename T>
+static std::span<const std::byte> In(const T& a) { return a; }
+template <typename T>
+static std::span<std::byte> Out(T& a) { return a; }
+
+static std::vector<Key> MakeKeys(size_t count)
+{
+    std::mt19937_64 rng{42};
+    std::vector<Key> keys(count);
+    for (auto& key : keys) {
+        for (auto& b : key) b = std::byte(rng());
+    }
+    return keys;
+}
+
+//
+// Cases
+//
+
+static void BenchDataStream(uint64_t iters)
+{
+    const Value value{};
+
+    DataStream ss{};
+    Bench("DataStream::write 40B", iters, [&](uint64_t) {
+        ss.write(value);
+        ss.clear();
+    });
+
+    DataStream ss_read{};
+    ss_read.reserve(VALUE_SIZE * (iters + iters / 10));
+    for (uint64_t i = 0; i < iters + iters / 10; i++) ss_read.write(value);
+    Value out;
+    Bench("DataStream::read 40B", iters, [&](uint64_t) {
+        ss_read.read(out);
+        DoNotOptimize(out);
+    });
+
+    DataStream ss_compact{};
+    ss_compact.write(value);
+    ss_compact.write(value);
+    Bench("DataStream::Compact 40B of 80B", iters, [&](uint64_t) {
+        ss_compact.read(out);
+        ss_compact.Compact();
+        ss_compact.write(value);
+    });
+}
+
+static void BenchSerialize(uint64_t iters)
+{
+    const Value value{};
+    DataStream ss{};
+    ss.reserve(VALUE_SIZE);
+
+    Bench("Serialize uint8_t", iters, [&](uint64_t i) {
+        ss << static_cast<uint8_t>(i);
+        ss.clear();
+    });
+    Bench("Serialize std::byte", iters, [&](uint64_t i) {
+        ss << std::byte(i);
+        ss.clear();
+    });
+    Bench("Serialize span 40B", iters, [&](uint64_t) {
+        ss << In(value);
+        ss.clear();
+    });
+
+    uint8_t out8;
+    Bench("Unserialize uint8_t", iters, [&](uint64_t i) {
+        ss << static_cast<uint8_t>(i);
+        ss >> out8;
+        DoNotOptimize(out8);
+    });
+    Value out;
+    std::span<std::byte> out_span{Out(out)};
+    Bench("Unserialize span 40B", iters, [&](uint64_t) {
+        ss << In(value);
+        ss >> out_span;
+        DoNotOptimize(out);
+    });
+}
+
+static void BenchWrapper(const std::filesystem::path& path, uint64_t iters)
+{
+    MDBXWrapper db(DBParams{.path = path, .cache_bytes = 0, .wipe_data = true});
+    const std::vector<Key> keys{MakeKeys(iters)};
+    const Value value{};
+
+    {
+        auto batch{DBRawAccess::CreateBatch(db)};
+        Bench("CDBBatchBase::Write 32B/40B", iters, [&](uint64_t i) {
+            batch->Write(In(keys[i]), In(value));
+        });
+        db.WriteBatch(*batch, /*fSync=*/false);
+    }
+
+    Value out;
+    std::span<std::byte> out_span{Out(out)};
+    Bench("CDBWrapperBase::Read", iters, [&](uint64_t i) {
+        db.Read(In(keys[i]), out_span);
+        DoNotOptimize(out);
+    });
+    Bench("  ReadImpl", iters, [&](uint64_t i) {
+        DoNotOptimize(DBRawAccess::Read(db, In(keys[i])));
+    });
+    Bench("CDBWrapperBase::Exists", iters, [&](uint64_t i) {
+        DoNotOptimize(db.Exists(In(keys[i])));
+    });
+    Bench("  ExistsImpl", iters, [&](uint64_t i) {
+        DoNotOptimize(DBRawAccess::Exists(db, In(keys[i])));
+    });
+
+    std::unique_ptr<CDBIteratorBase> it{db.NewIterator()};
+    it->SeekToFirst();
+    Key key_out;
+    std::span<std::byte> key_span{Out(key_out)};
+    Bench("CDBIteratorBase::GetKey", iters, [&](uint64_t) {
+        it->GetKey(key_span);
+        DoNotOptimize(key_out);
+    });
+    Bench("CDBIteratorBase::GetValue", iters, [&](uint64_t) {
+        it->GetValue(out_span);
+        DoNotOptimize(out);
+    });
+}
+
+// Serialized coins: height and coinbase flag, compressed amount, then a script
+// that is either compressed to a type byte and a hash or kept verbatim.
+static std::vector<std::vector<std::byte>> MakeCoinValues(size_t count)
+{
+    std::mt19937_64 rng{7};
+    std::vector<std::vector<std::byte>> values(count);
+    for (auto& value : values) {
+        auto put = [&](uint8_t b) { value.push_back(std::byte{b}); };
+        auto put_random = [&](size_t n) { for (size_t i = 0; i < n; i++) put(rng()); };
+
+        // VARINT(height * 2 + coinbase), mostly three bytes for recent heights
+        put(0x80 | (rng() & 0x7f)); put(0x80 | (rng() & 0x7f)); put(rng() & 0x7f);
+        // VARINT(CompressAmount(amount)): round amounts compress to a byte or two
+        if (rng() % 2) { put(rng() & 0x7f); } else { put(0x80 | (rng() & 0x7f)); put(0x80 | (rng() & 0x7f)); put(rng() & 0x7f); }
+
+        switch (rng() % 4) {
+        case 0: put(0x1c); put(0x00); put(0x14); put_random(20); break; // P2WPKH
+        case 1: put(0x28); put(0x51); put(0x20); put_random(32); break; // P2TR
+        case 2: put(0x00); put_random(20); break;                       // compressed P2PKH
+        case 3: put(0x01); put_random(20); break;                       // compressed P2SH
+        }
+    }
+    return values;
+}
+
+// Fraction of the pages of a file that are in the page cache.
+static double PageCacheResidency(const std::filesystem::path& file)
+{
+    FILE* f{fopen(file.c_str(), "rb")};
+    if (!f) return 0;
+    struct stat st{};
+    fstat(fileno(f), &st);
+    const size_t page{static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+    const size_t pages{(static_cast<size_t>(st.st_size) + page - 1) / page};
+    double resident{0};
+    if (void* map{pages ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fileno(f), 0) : MAP_FAILED}; map != MAP_FAILED) {
+        std::vector<unsigned char> vec(pages);
+        if (mincore(map, st.st_size, vec.data()) == 0) {
+            for (const unsigned char v : vec) resident += v & 1;
+            resident /= pages;
+        }
+        munmap(map, st.st_size);
+    }
+    fclose(f);
+    return resident;
+}
+
+// Drop a file's pages from the page cache. Has no effect on tmpfs.
+static void EvictPageCache(const std::filesystem::path& file)
+{
+    const int fd{open(file.c_str(), O_RDONLY)};
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Pages on tmpfs cannot be evicted, so cold cache cases are meaningless there.
+static bool IsTmpfs(const std::filesystem::path& path)
+{
+    struct statfs fs{};
+    return statfs(path.c_str(), &fs) == 0 && fs.f_type == TMPFS_MAGIC;
+}
+
+static uint64_t MajorFaults()
+{
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_majflt;
+}
+
+static void BenchCodec(const std::filesystem::path& path, uint64_t iters)
+{
+    const std::vector<std::vector<std::byte>> values{MakeCoinValues(std::min<uint64_t>(iters, 1 << 16))};
+    const ValueCodec* codec{CodecForTag(CODEC_TAG_DICT_LZ)};
+
+    std::vector<std::byte> encoded;
+    Bench("DictLZCodec::Encode coin", iters, [&](uint64_t i) {
+        EncodeValue(codec, values[i % values.size()], encoded);
+        DoNotOptimize(encoded);
+    });
+    std::vector<std::vector<std::byte>> stored(values.size());
+    for (size_t i = 0; i < values.size(); i++) EncodeValue(codec, values[i], stored[i]);
+    std::string decoded;
+    Bench("DictLZCodec::Decode coin", iters, [&](uint64_t i) {
+        DecodeValue(stored[i % stored.size()], decoded);
+        DoNotOptimize(decoded);
+    });
+
+    // The same coins with and without compression, each read back at random,
+    // first from a cold page cache and then warm.
+    const std::vector<Key> keys{MakeKeys(iters)};
+    const bool tmpfs{IsTmpfs(path)};
+    for (const uint8_t tag : {CODEC_TAG_RAW, CODEC_TAG_DICT_LZ}) {
+        const std::string label{tag == CODEC_TAG_RAW ? "raw" : "dict-lz"};
+        const std::filesystem::path db_path{path / ("codec_" + label)};
+        const std::filesystem::path data_file{db_path / "mdbx.dat"};
+        std::filesystem::create_directories(db_path);
+        uint64_t file_bytes{0};
+        {
+            MDBXWrapper db(DBParams{.path = db_path, .cache_bytes = 0, .wipe_data = true, .value_codec = tag});
+            auto batch{DBRawAccess::CreateBatch(db)};
+            for (uint64_t i = 0; i < iters; i++) {
+                batch->Write(In(keys[i]), std::span<const std::byte>{values[i % values.size()]});
+            }
+            db.WriteBatch(*batch, /*fSync=*/true);
+            batch.reset();
+            file_bytes = db.Compact().file_bytes_after;
+        }
+
+        // Evicted before the environment is mapped again, mapped pages are not dropped.
+        EvictPageCache(data_file);
+        MDBXWrapper db(DBParams{.path = db_path, .cache_bytes = 0, .value_codec = tag});
+        std::mt19937_64 rng{1};
+        if (tmpfs) {
+            std::cout << "  " << label << ": " << file_bytes << " bytes on disk, page cache not measured, "
+                      << path << " is on tmpfs" << std::endl;
+        } else {
+            // Not repeated like a Bench case, whose warm-up would heat the cache.
+            const uint64_t faults_before{MajorFaults()};
+            for (uint64_t i = 0; i < iters; i++) {
+                DoNotOptimize(DBRawAccess::Read(db, In(keys[rng() % iters])));
+            }
+            const uint64_t faults{MajorFaults() - faults_before};
+            std::cout << "  " << label << ": " << file_bytes << " bytes on disk, " << std::fixed << std::setprecision(3)
+                      << static_cast<double>(faults) / iters << " major faults per cold read, " << std::setprecision(1)
+                      << PageCacheResidency(data_file) * 100 << "% in page cache after " << iters << " reads" << std::endl;
+        }
+        Bench("CDBWrapperBase::Read coin " + label, iters, [&](uint64_t) {
+            DoNotOptimize(DBRawAccess::Read(db, In(keys[rng() % iters])));
+        });
+    }
+}
+
+// A coroutine that runs on its own once started, for issuing many lookups at once.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Resumed by RunAsyncReads() on the thread that started it.
+static DetachedTask LookupAsync(const MDBXWrapper& db, const Key& key, uint64_t& done)
+{
+    DoNotOptimize(co_await db.ReadAsync(In(key)));
+    done++;
+}
+
+// Random lookups starting from a cold page cache, issued one at a time with
+// Read and all at once with ReadAsync. Lookups are not repeated, so they are
+// timed directly rather than through Bench, whose warm-up would heat the cache.
+static void BenchColdRead(const std::filesystem::path& path, uint64_t iters)
+{
+    if (IsTmpfs(path)) {
+        std::cout << "Read/ReadAsync cold: skipped, " << path << " is on tmpfs and cannot be evicted, "
+                  << "pass a directory on disk as the second argument" << std::endl;
+        return;
+    }
+
+    const std::filesystem::path db_path{path / "cold"};
+    const std::filesystem::path data_file{db_path / "mdbx.dat"};
+    std::filesystem::create_directories(db_path);
+    const std::vector<Key> keys{MakeKeys(iters)};
+    {
+        MDBXWrapper db(DBParams{.path = db_path, .cache_bytes = 0, .wipe_data = true});
+        auto batch{DBRawAccess::CreateBatch(db)};
+        const Value value{};
+        for (const Key& key : keys) batch->Write(In(key), In(value));
+        db.WriteBatch(*batch, /*fSync=*/true);
+    }
+
+    std::vector<uint64_t> order(iters);
+    std::mt19937_64 rng{3};
+    for (auto& i : order) i = rng() % iters;
+
+    auto report = [&](const std::string& name, std::chrono::steady_clock::duration elapsed, double residency) {
+        std::cout << std::left << std::setw(36) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << std::chrono::duration<double, std::nano>(elapsed).count() / iters
+                  << "  (" << static_cast<uint64_t>(iters / std::chrono::duration<double>(elapsed).count())
+                  << " lookups/s, " << std::setprecision(0) << residency * 100 << "% cached at start)" << std::endl;
+    };
+
+    {
+        EvictPageCache(data_file);
+        MDBXWrapper db(DBParams{.path = db_path, .cache_bytes = 0});
+        const double residency{PageCacheResidency(data_file)};
+        const auto start{std::chrono::steady_clock::now()};
+        for (const uint64_t i : order) {
+            DoNotOptimize(DBRawAccess::Read(db, In(keys[i])));
+        }
+        report("Read cold", std::chrono::steady_clock::now() - start, residency);
+    }
+
+    {
+        // Outlives db, whose destructor joins the prefetch threads.
+        uint64_t done{0};
+        EvictPageCache(data_file);
+        MDBXWrapper db(DBParams{.path = db_path, .cache_bytes = 0});
+        const double residency{PageCacheResidency(data_file)};
+        const auto start{std::chrono::steady_clock::now()};
+        for (const uint64_t i : order) {
+            LookupAsync(db, keys[i], done);
+        }
+        db.RunAsyncReads();
+        assert(done == iters);
+        report("ReadAsync cold", std::chrono::steady_clock::now() - start, residency);
+    }
+}
+
+// Cost of maintaining set statistics in each write, and of reading them
+// compared with the full scan they replace.
+static void BenchSetStats(const std::filesystem::path& path, uint64_t iters)
+{
+    MDBXWrapper db(DBParams{.path = path, .cache_bytes = 0, .wipe_data = true, .options = {.maintain_set_stats = true}});
+    const std::vector<Key> keys{MakeKeys(iters)};
+    const Value value{};
+
+    {
+        auto batch{DBRawAccess::CreateBatch(db)};
+        Bench("CDBBatchBase::Write with set stats", iters, [&](uint64_t i) {
+            batch->Write(In(keys[i]), In(value));
+        });
+        db.WriteBatch(*batch, /*fSync=*/false);
+    }
+
+    Bench("MDBXWrapper::GetSetStats", 100, [&](uint64_t) {
+        DoNotOptimize(db.GetSetStats());
+    });
+    Bench("  full scan", 1, [&](uint64_t) {
+        uint64_t entries{0};
+        std::unique_ptr<CDBIteratorBase> it{db.NewIterator()};
+        for (it->SeekToFirst(); it->Valid(); it->Next()) ++entries;
+        DoNotOptimize(entries);
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    const uint64_t iters{argc > 1 ? std::stoull(argv[1]) : 1'000'000};
+
+    // Keep the database in memory so that only the wrapper's own cost is measured.
+    const std::filesystem::path base{argc > 2                               ? std::filesystem::path{argv[2]}
+                                     : std::filesystem::exists("/dev/shm") ? std::filesystem::path{"/dev/shm"}
+                                                                           : std::filesystem::temp_directory_path()};
+    const std::filesystem::path path{base / ("exampledb_bench_" + std::to_string(getpid()))};
+    std::filesystem::create_directories(path);
+
+    std::cout << std::left << std::setw(36) << "benchmark" << std::right << std::setw(10) << "ns/op"
+              << std::setw(12) << "allocs/op" << std::setw(14) << "instr/op" << std::endl;
+
+    BenchDataStream(iters);
+    BenchSerialize(iters);
+    BenchWrapper(path, iters);
+    BenchCodec(path, iters);
+    BenchColdRead(path, iters);
+    BenchSetStats(path, iters);
+
+    std::filesystem::remove_all(path);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+
+#include "codec.h"
+
+static constexpr size_t DICT_LZ_MIN_MATCH{3};
+static constexpr size_t DICT_LZ_MAX_MATCH{0x7f + DICT_LZ_MIN_MATCH};
+static constexpr size_t DICT_LZ_MAX_LITERAL{0x80};
+static constexpr size_t DICT_LZ_MAX_DISTANCE{0xffff};
+// Hash chain steps followed per position, and how far back into the value
+// itself the encoder looks, to bound the cost of encoding large values.
+static constexpr size_t DICT_LZ_MAX_CHAIN{16};
+static constexpr size_t DICT_LZ_MAX_SELF_SCAN{256};
+static constexpr int DICT_LZ_HASH_BITS{10};
+
+// Patterns that show up in serialized coins. Coin serialization compresses
+// P2PKH, P2SH and P2PK scripts, but stores others verbatim behind their size
+// plus 6, so segwit outputs start with one of a few fixed prefixes.
+static const std::vector<uint8_t> DICT_LZ_DICTIONARY{
+    // runs of zeros, in amounts and in padding
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // OP_1 OP_PUSHBYTES_33, OP_2 OP_PUSHBYTES_33: bare multisig
+    0x51, 0x21, 0x52, 0x21,
+    // uncompressed P2PKH and P2SH, for values that do not use script compression
+    0x76, 0xa9, 0x14, 0x88, 0xac, 0xa9, 0x14, 0x87,
+    // P2WSH: size 34+6, OP_0 OP_PUSHBYTES_32
+    0x28, 0x00, 0x20,
+    // P2TR: size 34+6, OP_1 OP_PUSHBYTES_32
+    0x28, 0x51, 0x20,
+    // P2WPKH: size 22+6, OP_0 OP_PUSHBYTES_20
+    0x1c, 0x00, 0x14,
+};
+
+static uint32_t Hash3(const std::byte* p)
+{
+    const uint32_t v{std::to_integer<uint32_t>(p[0]) | std::to_integer<uint32_t>(p[1]) << 8 | std::to_integer<uint32_t>(p[2]) << 16};
+    return (v * 2654435761U) >> (32 - DICT_LZ_HASH_BITS);
+}
+
+DictLZCodec::DictLZCodec()
+    : m_head(size_t{1} << DICT_LZ_HASH_BITS, -1)
+{
+    for (const uint8_t b : DICT_LZ_DICTIONARY) {
+        m_dict.push_back(std::byte{b});
+    }
+    m_chain.assign(m_dict.size(), -1);
+    for (size_t i = 0; i + DICT_LZ_MIN_MATCH <= m_dict.size(); i++) {
+        const uint32_t h{Hash3(&m_dict[i])};
+        m_chain[i] = m_head[h];
+        m_head[h] = i;
+    }
+}
+
+bool DictLZCodec::Encode(std::span<const std::byte> value, std::vector<std::byte>& out) const
+{
+    const size_t start_size{out.size()};
+    const size_t dict_size{m_dict.size()};
+
+    // Matches are found in the window formed by the dictionary followed by the value.
+    auto window = [&](size_t i) { return i < dict_size ? m_dict[i] : value[i - dict_size]; };
+
+    size_t literal_start{0};
+    auto flush_literals = [&](size_t end) {
+        while (literal_start < end) {
+            const size_t run{std::min(end - literal_start, DICT_LZ_MAX_LITERAL)};
+            out.push_back(std::byte(run - 1));
+            out.insert(out.end(), value.begin() + literal_start, value.begin() + literal_start + run);
+            literal_start += run;
+        }
+    };
+
+    size_t pos{0};
+    while (pos + DICT_LZ_MIN_MATCH <= value.size()) {
+        const size_t cur{dict_size + pos};
+        const size_t max_len{std::min(DICT_LZ_MAX_MATCH, value.size() - pos)};
+        size_t best_len{0};
+        size_t best_dist{0};
+        auto try_match = [&](size_t candidate) {
+            size_t len{0};
+            while (len < max_len && window(candidate + len) == value[pos + len]) ++len;
+            if (len > best_len && cur - candidate <= DICT_LZ_MAX_DISTANCE) {
+                best_len = len;
+                best_dist = cur - candidate;
+            }
+        };
+
+        size_t steps{0};
+        for (int32_t candidate{m_head[Hash3(&value[pos])]}; candidate >= 0 && steps < DICT_LZ_MAX_CHAIN; candidate = m_chain[candidate], steps++) {
+            try_match(candidate);
+        }
+        for (size_t p = pos > DICT_LZ_MAX_SELF_SCAN ? pos - DICT_LZ_MAX_SELF_SCAN : 0; p < pos; p++) {
+            try_match(dict_size + p);
+        }
+
+        if (best_len >= DICT_LZ_MIN_MATCH) {
+            flush_literals(pos);
+            out.push_back(std::byte(0x80 | (best_len - DICT_LZ_MIN_MATCH)));
+            out.push_back(std::byte(best_dist & 0xff));
+            out.push_back(std::byte(best_dist >> 8));
+            pos += best_len;
+            literal_start = pos;
+        } else {
+            pos++;
+        }
+    }
+    flush_literals(value.size());
+
+    return out.size() - start_size < value.size();
+}
+
+bool DictLZCodec::Decode(std::span<const std::byte> encoded, std::string& out) const
+{
+    const size_t base{out.size()};
+    const size_t dict_size{m_dict.size()};
+
+    size_t i{0};
+    while (i < encoded.size()) {
+        const uint8_t control{std::to_integer<uint8_t>(encoded[i++])};
+        if (control < 0x80) {
+            const size_t run{size_t{control} + 1};
+            if (encoded.size() - i < run) return false;
+            out.append(reinterpret_cast<const char*>(encoded.data() + i), run);
+            i += run;
+            continue;
+        }
+
+        if (encoded.size() - i < 2) return false;
+        const size_t len{size_t{control & 0x7fU} + DICT_LZ_MIN_MATCH};
+        const size_t dist{std::to_integer<size_t>(encoded[i]) | std::to_integer<size_t>(encoded[i + 1]) << 8};
+        i += 2;
+        if (dist == 0 || dist > dict_size + (out.size() - base)) return false;
+
+        // Byte by byte, since a match may overlap the bytes it produces.
+        for (size_t k = 0; k < len; k++) {
+            const size_t src{dict_size + (out.size() - base) - dist};
+            out.push_back(src < dict_size ? static_cast<char>(m_dict[src]) : out[base + src - dict_size]);
+        }
+    }
+    return true;
+}
+
+const ValueCodec* CodecForTag(uint8_t tag)
+{
+    static const DictLZCodec dict_lz;
+
+    switch (tag) {
+    case CODEC_TAG_DICT_LZ:
+        return &dict_lz;
+    default:
+        return nullptr;
+    }
+}
+
+void EncodeValue(const ValueCodec* codec, std::span<const std::byte> value, std::vector<std::byte>& out)
+{
+    out.clear();
+    if (codec) {
+        out.push_back(std::byte{codec->Tag()});
+        if (codec->Encode(value, out)) return;
+        out.clear();
+    }
+    out.push_back(std::byte{CODEC_TAG_RAW});
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+bool DecodeValue(std::span<const std::byte> stored, std::string& out)
+{
+    out.clear();
+    if (stored.empty()) return false;
+
+    const uint8_t tag{std::to_integer<uint8_t>(stored[0])};
+    const std::span<const std::byte> body{stored.subspan(1)};
+    if (tag == CODEC_TAG_RAW) {
+        out.assign(reinterpret_cast<const char*>(body.data()), body.size());
+        return true;
+    }
+    const ValueCodec* codec{CodecForTag(tag)};
+    return codec && codec->Decode(body, out);
+}
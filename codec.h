@@ -0,0 +1,82 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// Stored values can be run through a ValueCodec. Every value in a database
+// that uses codecs is prefixed with the tag of the codec that produced it, so
+// values written with different codecs, or stored as is, remain readable.
+
+//! Tag of values stored as is, behind the tag byte.
+static constexpr uint8_t CODEC_TAG_RAW{0};
+//! Tag of values compressed by DictLZCodec.
+static constexpr uint8_t CODEC_TAG_DICT_LZ{1};
+
+/** A reversible transform of stored values */
+class ValueCodec
+{
+public:
+    virtual ~ValueCodec() = default;
+
+    //! Tag stored in front of values produced by this codec.
+    virtual uint8_t Tag() const = 0;
+
+    /**
+     * Append the encoded form of value to out.
+     * @returns false, leaving out in an unspecified state, if encoding does not make the value smaller.
+     */
+    virtual bool Encode(std::span<const std::byte> value, std::vector<std::byte>& out) const = 0;
+
+    /**
+     * Append the decoded form of encoded to out.
+     * @returns false if encoded is malformed.
+     */
+    virtual bool Decode(std::span<const std::byte> encoded, std::string& out) const = 0;
+};
+
+/**
+ * LZ77 with a preset dictionary of byte patterns common in serialized coins,
+ * such as the segwit script templates that coin serialization keeps verbatim.
+ * Values are short, so most of the gain comes from matches into the dictionary.
+ *
+ * The encoding is a sequence of tokens. A control byte below 0x80 is followed
+ * by that many plus one literal bytes. Otherwise its low 7 bits plus
+ * DICT_LZ_MIN_MATCH give the length of a match, followed by the 2-byte little
+ * endian distance back into the dictionary and the output so far.
+ */
+class DictLZCodec : public ValueCodec
+{
+private:
+    std::vector<std::byte> m_dict;
+    //! For each 3-byte hash, the last dictionary position starting with it, or -1.
+    std::vector<int32_t> m_head;
+    //! For each dictionary position, the previous one with the same hash, or -1.
+    std::vector<int32_t> m_chain;
+
+public:
+    DictLZCodec();
+
+    uint8_t Tag() const override { return CODEC_TAG_DICT_LZ; }
+    bool Encode(std::span<const std::byte> value, std::vector<std::byte>& out) const override;
+    bool Decode(std::span<const std::byte> encoded, std::string& out) const override;
+};
+
+//! The codec registered for a tag, or nullptr for CODEC_TAG_RAW and unknown tags.
+const ValueCodec* CodecForTag(uint8_t tag);
+
+/**
+ * Encode value for storage as its tag followed by the encoded bytes, falling
+ * back to CODEC_TAG_RAW when codec is null or does not shrink the value.
+ */
+void EncodeValue(const ValueCodec* codec, std::span<const std::byte> value, std::vector<std::byte>& out);
+
+/**
+ * Decode a tagged stored value into out.
+ * @returns false for an unknown tag or malformed data.
+ */
+bool DecodeValue(std::span<const std::byte> stored, std::string& out);
+
+#endif // CODEC_H
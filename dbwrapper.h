@@ -3,8 +3,10 @@
 
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <span>
+#include <string>
 
 #include "util.h"
 
@@ -25,6 +27,18 @@ static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 struct DBOptions {
     //! Compact database on startup.
     bool force_compact = false;
+    //! Commit a batch in several consecutive transactions, each holding at
+    //! most this many bytes of dirty pages. 0 commits every batch at once.
+    size_t max_txn_dirty_bytes = 0;
+    //! Park readers whose view falls more than this many commits behind, so
+    //! that they stop pinning old pages. 0 never parks them.
+    uint64_t max_reader_lag = 0;
+    //! Threads prefetching the pages of asynchronous reads, started on first
+    //! use, so that this many cold lookups overlap their I/O.
+    size_t async_read_threads = 16;
+    //! Maintain a MuHash of all entries, with their count and value bytes,
+    //! updated by every batch, so that set statistics need no full scan.
+    bool maintain_set_stats = false;
 };
 
 //! Application-specific storage settings.
@@ -40,6 +54,9 @@ struct DBParams {
     //! If true, store data obfuscated via simple XOR. If false, XOR with a
     //! zero'd byte array.
     bool obfuscate = false;
+    //! Tag of the ValueCodec (see codec.h) that compresses stored values, 0
+    //! for none. Once a database holds tagged values, it keeps tagging them.
+    uint8_t value_codec = 0;
     //! Passed-through options.
     DBOptions options{};
 };
@@ -50,10 +67,13 @@ static inline std::string PathToString(const std::filesystem::path path)
 }
 
 class CDBWrapperBase;
+struct DBRawAccess;
 
 /** Batch of changes queued to be written to a CDBWrapper */
 class CDBBatchBase
 {
+    friend struct DBRawAccess;
+
 protected:
     const CDBWrapperBase& m_parent;
 
@@ -64,6 +84,7 @@ protected:
 
     virtual void WriteImpl(std::span<const std::byte> key, DataStream& ssValue) = 0;
     virtual void EraseImpl(std::span<const std::byte> key) = 0;
+    virtual void EraseRangeImpl(std::span<const std::byte> begin, std::span<const std::byte> end) = 0;
 
 public:
     /**
@@ -95,6 +116,19 @@ public:
         EraseImpl(ssKey);
         ssKey.clear();
     }
+
+    /** Erase every key in [begin, end). */
+    template <typename K>
+    void EraseRange(const K& begin, const K& end)
+    {
+        DataStream ssKeyEnd{};
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKeyEnd.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey << begin;
+        ssKeyEnd << end;
+        EraseRangeImpl(ssKey, ssKeyEnd);
+        ssKey.clear();
+    }
 };
 
 class CDBIteratorBase;
@@ -102,6 +136,7 @@ class CDBIteratorBase;
 class CDBWrapperBase
 {
     // friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapperBase &w);
+    friend struct DBRawAccess;
 
 protected:
     CDBWrapperBase(const DBParams& params)
@@ -225,6 +260,8 @@ public:
 
 class CDBIteratorBase
 {
+    friend struct DBRawAccess;
+
 protected:
     const CDBWrapperBase &parent;
 
@@ -270,4 +307,24 @@ public:
     virtual void Next() = 0;
 };
 
+/**
+ * Forwards to the protected *Impl methods, for wrappers that stack on top of
+ * another CDBWrapperBase (e.g. tracing) and so handle keys and values that
+ * have already been serialized.
+ */
+struct DBRawAccess {
+    static std::optional<std::string> Read(const CDBWrapperBase& db, std::span<const std::byte> key) { return db.ReadImpl(key); }
+    static bool Exists(const CDBWrapperBase& db, std::span<const std::byte> key) { return db.ExistsImpl(key); }
+    static size_t EstimateSize(const CDBWrapperBase& db, std::span<const std::byte> key1, std::span<const std::byte> key2) { return db.EstimateSizeImpl(key1, key2); }
+    static std::unique_ptr<CDBBatchBase> CreateBatch(const CDBWrapperBase& db) { return db.CreateBatch(); }
+
+    static void Write(CDBBatchBase& batch, std::span<const std::byte> key, DataStream& ssValue) { batch.WriteImpl(key, ssValue); }
+    static void Erase(CDBBatchBase& batch, std::span<const std::byte> key) { batch.EraseImpl(key); }
+    static void EraseRange(CDBBatchBase& batch, std::span<const std::byte> begin, std::span<const std::byte> end) { batch.EraseRangeImpl(begin, end); }
+
+    static void Seek(CDBIteratorBase& it, std::span<const std::byte> key) { it.SeekImpl(key); }
+    static std::span<const std::byte> Key(const CDBIteratorBase& it) { return it.GetKeyImpl(); }
+    static std::span<const std::byte> Value(const CDBIteratorBase& it) { return it.GetValueImpl(); }
+};
+
 #endif // DBWRAPPER_H
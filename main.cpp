@@ -1,12 +1,19 @@
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <span>
+#include <string>
 #include <vector>
 
 #include <mdbx.h++>
 
+#include "codec.h"
 #include "kv.h"
 #include "mdbx.h"
+#include "shard.h"
+#include "trace.h"
 //
 // Overload the left shift operator to print std::span<const std::byte>
 std::ostream& operator<<(std::ostream& os, const std::span<const std::byte>& bytes) {
@@ -17,11 +24,47 @@ std::ostream& operator<<(std::ostream& os, const std::span<const std::byte>& byt
     return os;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     std::filesystem::path data_path;
+    DBOptions options{};
+    std::filesystem::path trace_path;
+    std::filesystem::path replay_path;
+    bool replay_paced{false};
+    size_t shard_count{0};
+    std::filesystem::path dump_path;
+    std::filesystem::path load_path;
+    uint8_t value_codec{0};
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg{argv[i]};
+        if (arg == "-forcecompactdb") {
+            options.force_compact = true;
+        } else if (arg.starts_with("-trace=")) {
+            trace_path = arg.substr(std::string{"-trace="}.size());
+        } else if (arg.starts_with("-replay=")) {
+            replay_path = arg.substr(std::string{"-replay="}.size());
+        } else if (arg == "-replaypaced") {
+            replay_paced = true;
+        } else if (arg.starts_with("-dumpsnapshot=")) {
+            dump_path = arg.substr(std::string{"-dumpsnapshot="}.size());
+        } else if (arg.starts_with("-loadsnapshot=")) {
+            load_path = arg.substr(std::string{"-loadsnapshot="}.size());
+        } else if (arg.starts_with("-maxreaderlag=")) {
+            options.max_reader_lag = std::stoull(arg.substr(std::string{"-maxreaderlag="}.size()));
+        } else if (arg == "-setstats") {
+            options.maintain_set_stats = true;
+        } else if (arg == "-compressvalues") {
+            value_codec = CODEC_TAG_DICT_LZ;
+        } else if (arg.starts_with("-shards=")) {
+            shard_count = std::stoul(arg.substr(std::string{"-shards="}.size()));
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
 
     try {
-        data_path = std::filesystem::current_path() / "data";
+        data_path = std::filesystem::current_path() / (shard_count ? "data_sharded" : "data");
         if (!std::filesystem::exists(data_path)) {
             if (!std::filesystem::create_directory(data_path)) {
                 throw std::runtime_error("Failed to create directory: " + data_path.string());
@@ -38,7 +81,55 @@ int main() {
         return 1;
     }
 
-    MDBXWrapper wrap_mdbx(data_path);
+    const DBParams params{.path = data_path, .cache_bytes = 0, .value_codec = value_codec, .options = options};
+    std::unique_ptr<CDBWrapperBase> backend;
+    if (shard_count) {
+        auto sharded{std::make_unique<ShardedWrapper>(params, shard_count)};
+        // The workload writes random data, so an interrupted flush has nothing to replay.
+        if (sharded->HasPartialCommit()) {
+            sharded->ClearPartialCommit();
+        }
+        backend = std::move(sharded);
+    } else {
+        backend = std::make_unique<MDBXWrapper>(params);
+    }
+
+    if (!dump_path.empty() || !load_path.empty()) {
+        auto* mdbx_db{dynamic_cast<MDBXWrapper*>(backend.get())};
+        if (!mdbx_db) {
+            std::cerr << "Snapshots are not supported with -shards" << std::endl;
+            return 1;
+        }
+        auto report = [](uint64_t done, uint64_t total) {
+            std::cout << "\r" << done << "/" << total << " entries" << std::flush;
+        };
+        const MDBXSnapshotStats stats{!dump_path.empty() ? mdbx_db->DumpSnapshot(dump_path, report)
+                                                          : mdbx_db->LoadSnapshot(load_path, report)};
+        const double seconds{std::chrono::duration<double>(stats.elapsed).count()};
+        std::cout << std::endl << (!dump_path.empty() ? "Dumped " : "Loaded ") << stats.entries << " entries, "
+                  << stats.bytes << " bytes in " << seconds << "s ("
+                  << static_cast<uint64_t>(stats.bytes / seconds / (1 << 20)) << " MiB/s)" << std::endl;
+        return 0;
+    }
+
+    // Record everything the workload does when asked to.
+    std::unique_ptr<TracingWrapper> tracer;
+    if (!trace_path.empty()) {
+        tracer = std::make_unique<TracingWrapper>(*backend, trace_path);
+    }
+    CDBWrapperBase& db = tracer ? static_cast<CDBWrapperBase&>(*tracer) : *backend;
+
+    if (!replay_path.empty()) {
+        const ReplayStats stats{ReplayTrace(TraceReader{replay_path}, db, replay_paced)};
+        std::cout << "Replayed " << stats.ops << " operations in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(stats.elapsed).count() << "ms, "
+                  << stats.divergent << " lookups diverged from the trace" << std::endl;
+        if (tracer) {
+            tracer->CloseTrace();
+        }
+        return 0;
+    }
+
     std::vector<KeyValuePair> pairs;
 
     // Generate 10 random key-value pairs
@@ -48,9 +139,38 @@ int main() {
 
     // Loop through and print the key-value pairs
     for (const auto& pair : pairs) {
-        wrap_mdbx.Write(pair.key_bytes(), pair.value);
+        db.Write(pair.key_bytes(), pair.value);
         // std::cout << "Key: " << pair.key << ", Value: " << std::to_string(pair.value) << std::endl;
     }
 
+    // Time a single large flush, the case sharding is meant to speed up.
+    std::vector<KeyValuePair> flush_pairs;
+    for (int i = 0; i < 99999; i++) {
+        flush_pairs.push_back(get_random_kvp());
+    }
+    const auto flush_start{std::chrono::steady_clock::now()};
+    auto batch{DBRawAccess::CreateBatch(db)};
+    for (const auto& pair : flush_pairs) {
+        batch->Write(pair.key_bytes(), pair.value);
+    }
+    db.WriteBatch(*batch, /*fSync=*/true);
+    batch.reset();
+    const auto flush_time{std::chrono::steady_clock::now() - flush_start};
+    std::cout << "Flushed " << flush_pairs.size() << " entries over " << std::max<size_t>(shard_count, 1) << " shard(s) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(flush_time).count() << "ms ("
+              << static_cast<uint64_t>(flush_pairs.size() / std::chrono::duration<double>(flush_time).count())
+              << " entries/s)" << std::endl;
+
+    if (tracer) {
+        tracer->CloseTrace();
+    }
+
+    if (auto* mdbx_db{dynamic_cast<MDBXWrapper*>(backend.get())}) {
+        if (const auto stats{mdbx_db->GetSetStats()}) {
+            std::cout << "Set hash " << std::span<const std::byte>{stats->hash} << ", " << std::dec << stats->entries
+                      << " entries, " << stats->value_bytes << " value bytes" << std::endl;
+        }
+    }
+
     return 0;
 }
@@ -1,17 +1,144 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
 #include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <openssl/evp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
 
 #include <mdbx.h++>
 
+#include "codec.h"
 #include "dbwrapper.h"
+#include "muhash.h"
 #include "util.h"
 #include "mdbx.h"
 
 // These are *impl* objects, defined here only to avoid dependencies in the header. (PIMPL)
 
+// Set statistics as carried through a write txn, see MDBXSetStats.
+struct MDBXSetStatsState {
+    MuHash3072 hash;
+    uint64_t entries{0};
+    uint64_t value_bytes{0};
+    // Reused to hash entries, and to decode values that are replaced or erased.
+    std::vector<std::byte> element;
+    std::string old_value;
+
+    // An entry is hashed as the key's 4-byte size, the key and the value, so
+    // that the split between key and value is unambiguous.
+    void Update(std::span<const std::byte> key, std::span<const std::byte> value, bool insert)
+    {
+        const uint32_t key_size{static_cast<uint32_t>(key.size())};
+        element.resize(sizeof(key_size));
+        std::memcpy(element.data(), &key_size, sizeof(key_size));
+        element.insert(element.end(), key.begin(), key.end());
+        element.insert(element.end(), value.begin(), value.end());
+        if (insert) {
+            hash.Insert(element);
+            entries++;
+            value_bytes += value.size();
+        } else {
+            hash.Remove(element);
+            entries--;
+            value_bytes -= value.size();
+        }
+    }
+};
+
 struct MDBXBatch::MDBXWriteBatchImpl {
     mdbx::txn_managed txn;
     mdbx::map_handle map;
+    // Reused to hold the tagged form of each written value.
+    std::vector<std::byte> encoded;
+    // Loaded from the txn when it begins, and stored back before each commit.
+    std::unique_ptr<MDBXSetStatsState> stats;
+};
+
+// Shared by an MDBXSnapshot and the iterators opened on it. The mutex is held
+// for every use of the txn, since commits renew or park it from their own thread.
+struct MDBXSnapshotState {
+    std::mutex mutex;
+    mdbx::txn_managed txn;
+    mdbx::map_handle map;
+    const MDBXSnapshotPolicy policy;
+    const bool tagged_values;
+    //! See DBOptions::max_reader_lag.
+    const uint64_t max_reader_lag;
+    // Iterators open on the txn. Renewing or parking the txn would invalidate
+    // their cursors and the spans they handed out, so commits leave it alone
+    // and the iterators park it themselves before they step.
+    size_t live_iterators{0};
+    // Set when the txn was released for lagging too far behind.
+    bool parked{false};
+
+    MDBXSnapshotState(MDBXSnapshotPolicy _policy, bool _tagged_values, uint64_t _max_reader_lag)
+        : policy{_policy}, tagged_values{_tagged_values}, max_reader_lag{_max_reader_lag} {}
+
+    void Park()
+    {
+        if (!parked) {
+            txn.reset_reading();
+            parked = true;
+        }
+    }
+
+    // Park the txn if it fell more than max_reader_lag commits behind.
+    // Returns the lag that caused it, or 0.
+    uint64_t ParkIfLagging()
+    {
+        if (parked || max_reader_lag == 0) return 0;
+        const uint64_t lag{txn.get_info().txn_reader_lag};
+        if (lag <= max_reader_lag) return 0;
+        Park();
+        return lag;
+    }
+};
+
+// Threads prefetching the pages of MDBXWrapper::ReadAsync() lookups, the
+// reads queued for them, and the reads ready to be resumed by RunAsyncReads().
+struct MDBXReadPool {
+    // Reads awaited on one thread, kept apart so that each thread only
+    // resumes its own.
+    struct Submitter {
+        // Prefetched and waiting to be resumed.
+        std::deque<MDBXReadAwaitable*> ready;
+        // Awaited and not yet resumed.
+        size_t outstanding{0};
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<MDBXReadAwaitable*> queue;
+    std::condition_variable ready_cv;
+    std::unordered_map<std::thread::id, Submitter> submitters;
+    std::vector<std::thread> workers;
+    bool stop{false};
+
+    // Prefetch what is still queued, then join the threads so they can be restarted.
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stop = true;
+        }
+        cv.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        stop = false;
+    }
 };
 
 // Defined in the implementation file to avoid mdbx includes in the header, in
@@ -27,26 +154,236 @@ struct MDBXContext {
     mdbx::env_managed env;
     mdbx::map_handle read_map;
 
+    // Snapshots and iterators that are renewed or parked after each commit.
+    std::mutex snapshots_mutex;
+    std::vector<std::weak_ptr<MDBXSnapshotState>> snapshots;
+
+    MDBXReadPool read_pool;
+
+    void Close()
+    {
+        // The read threads hold txns of their own.
+        read_pool.Stop();
+        {
+            // A snapshot that outlives the environment must not touch it again.
+            std::lock_guard<std::mutex> lock{snapshots_mutex};
+            for (const auto& weak : snapshots) {
+                if (auto state{weak.lock()}) {
+                    std::lock_guard<std::mutex> state_lock{state->mutex};
+                    state->txn.abort();
+                    state->parked = true;
+                }
+            }
+            snapshots.clear();
+        }
+        if (read_txn) {
+            read_txn.abort();
+        }
+        if (env) {
+            env.close();
+        }
+    }
+
     ~MDBXContext()
     {
-        read_txn.abort();
-        env.close();
+        Close();
     }
 };
 
-MDBXWrapper::MDBXWrapper(std::filesystem::path path)
-    : CDBWrapperBase(DBParams{}),
-    m_db_context{std::make_unique<MDBXContext>()}
+// Marks that a split batch is in progress, erased by the commit of its last part.
+// Each batch gets its own marker, suffixed with the id of the txn that wrote
+// it, so a later batch cannot clear the marker of an interrupted one.
+static const std::string MDBX_PARTIAL_BATCH_PREFIX{std::string{MDBX_RESERVED_KEY_PREFIX} + "partial_batch/"};
+
+// Present when stored values carry a codec tag, see codec.h.
+static const std::string MDBX_VALUE_FORMAT_KEY{std::string{MDBX_RESERVED_KEY_PREFIX} + "value_format"};
+
+// The MuHash3072 state of MDBXSetStats, followed by its entry count and value
+// bytes as 8-byte little endian integers.
+static const std::string MDBX_SET_STATS_KEY{std::string{MDBX_RESERVED_KEY_PREFIX} + "set_stats"};
+static constexpr size_t MDBX_SET_STATS_SIZE{MuHash3072::SERIALIZED_SIZE + 2 * sizeof(uint64_t)};
+
+static_assert(std::endian::native == std::endian::little, "set statistics format assumes a little-endian host");
+
+static bool ReadSetStats(const mdbx::txn& txn, mdbx::map_handle map, MDBXSetStatsState& stats)
 {
+    const mdbx::slice slValue{txn.get(map, mdbx::slice(MDBX_SET_STATS_KEY.data(), MDBX_SET_STATS_KEY.size()), mdbx::slice::invalid())};
+    if (slValue == mdbx::slice::invalid()) {
+        return false;
+    }
+    if (slValue.size() != MDBX_SET_STATS_SIZE) {
+        throw dbwrapper_error("Malformed set statistics");
+    }
+    const auto bytes{std::as_bytes(slValue.bytes())};
+    stats.hash.Unserialize(bytes.first<MuHash3072::SERIALIZED_SIZE>());
+    std::memcpy(&stats.entries, bytes.data() + MuHash3072::SERIALIZED_SIZE, sizeof(uint64_t));
+    std::memcpy(&stats.value_bytes, bytes.data() + MuHash3072::SERIALIZED_SIZE + sizeof(uint64_t), sizeof(uint64_t));
+    return true;
+}
+
+static void WriteSetStats(mdbx::txn& txn, mdbx::map_handle map, const MDBXSetStatsState& stats)
+{
+    std::array<std::byte, MDBX_SET_STATS_SIZE> bytes;
+    stats.hash.Serialize(std::span{bytes}.first<MuHash3072::SERIALIZED_SIZE>());
+    std::memcpy(bytes.data() + MuHash3072::SERIALIZED_SIZE, &stats.entries, sizeof(uint64_t));
+    std::memcpy(bytes.data() + MuHash3072::SERIALIZED_SIZE + sizeof(uint64_t), &stats.value_bytes, sizeof(uint64_t));
+    txn.upsert(map, mdbx::slice(MDBX_SET_STATS_KEY.data(), MDBX_SET_STATS_KEY.size()), mdbx::slice(bytes.data(), bytes.size()));
+}
+
+// The value as written by the caller, undoing the value codec if there is one.
+static std::span<const std::byte> LogicalValue(const mdbx::slice& stored, bool tagged_values, std::string& buffer)
+{
+    if (!tagged_values) {
+        return std::as_bytes(stored.bytes());
+    }
+    if (!DecodeValue(std::as_bytes(stored.bytes()), buffer)) {
+        throw dbwrapper_error("Undecodable value");
+    }
+    return std::as_bytes(std::span{buffer});
+}
+
+static bool HasKey(const MDBXContext& ctx, const std::string& key)
+{
+    mdbx::slice slKey(key.data(), key.size());
+    return ctx.read_txn.get(ctx.read_map, slKey, mdbx::slice::invalid()) != mdbx::slice::invalid();
+}
+
+static bool IsReservedKey(const mdbx::slice& key)
+{
+    return key.size() >= MDBX_RESERVED_KEY_PREFIX.size() &&
+           std::memcmp(key.data(), MDBX_RESERVED_KEY_PREFIX.data(), MDBX_RESERVED_KEY_PREFIX.size()) == 0;
+}
+
+// Step the cursor over bookkeeping entries, so callers only see user data.
+static void SkipReserved(mdbx::cursor& cursor)
+{
+    while (!cursor.eof() && IsReservedKey(cursor.current().key)) {
+        cursor.to_next(/*throw_notfound=*/false);
+    }
+}
+
+// How many keys EraseRangeImpl removes between checks for a txn split.
+static constexpr size_t MDBX_ERASE_RANGE_SPLIT_INTERVAL{1024};
+
+// Whether key sorts before end in MDBX's default (lexicographic) key order.
+static bool KeyBefore(const mdbx::slice& key, std::span<const std::byte> end)
+{
+    return std::ranges::lexicographical_compare(std::as_bytes(key.bytes()), end);
+}
+
+// Snapshot files start with this header. Entries follow as a 4-byte key size,
+// a 4-byte value size, the key and the value, and the file ends with a
+// SHA256 of all entry bytes. Integers are little endian.
+
+static_assert(std::endian::native == std::endian::little, "snapshot format assumes a little-endian host");
+
+static constexpr char MDBX_SNAPSHOT_MAGIC[8] = {'m', 'd', 'b', 'x', 's', 'n', 'a', 'p'};
+static constexpr uint32_t MDBX_SNAPSHOT_VERSION{1};
+
+struct MDBXSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t entries;
+    uint64_t payload_bytes;
+};
+
+// A bulk load commits once this many bytes have been appended, large enough
+// to amortize commits while bounding the dirty pages held in memory.
+static constexpr size_t MDBX_BULK_TXN_BYTES{256 << 20};
+// Entries between two progress reports.
+static constexpr uint64_t MDBX_PROGRESS_INTERVAL{1 << 16};
+
+// Name of the data file inside the environment directory.
+static const char* const MDBX_DATA_FILE{"mdbx.dat"};
+
+// Geometry used when opening an environment. The shrink threshold lets MDBX
+// return unused space at the end of the file to the filesystem on commit.
+static constexpr intptr_t MDBX_GROWTH_STEP{16 << 20};
+static constexpr intptr_t MDBX_SHRINK_THRESHOLD{64 << 20};
+
+static void OpenContext(MDBXContext& ctx, const std::filesystem::path& path)
+{
+    ctx.create_params.geometry.growth_step = MDBX_GROWTH_STEP;
+    ctx.create_params.geometry.shrink_threshold = MDBX_SHRINK_THRESHOLD;
+
+    // Tie reader slots to txns rather than threads: a thread may then hold
+    // several snapshots, and commits may renew or park them from any thread.
+#if MDBX_VERSION_MAJOR > 0 || MDBX_VERSION_MINOR >= 13
+    ctx.operate_params.options.no_sticky_threads = true;
+#else
+    ctx.operate_params.options.orphan_read_transactions = true;
+#endif
+
     // initialize the mdbx environment.
-    DBContext().env = mdbx::env_managed(path, DBContext().create_params, DBContext().operate_params);
+    ctx.env = mdbx::env_managed(path, ctx.create_params, ctx.operate_params);
 
-    auto tempwrite = DBContext().env.start_write();
-     tempwrite.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single);
+    auto tempwrite = ctx.env.start_write();
+    tempwrite.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single);
     tempwrite.commit();
 
-    DBContext().read_txn = DBContext().env.start_read();
-    DBContext().read_map = DBContext().read_txn.open_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single);
+    ctx.read_txn = ctx.env.start_read();
+    ctx.read_map = ctx.read_txn.open_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single);
+}
+
+// Walk every entry of the main map, as a rough measure of sequential read speed.
+static std::chrono::nanoseconds TimeFullScan(MDBXContext& ctx, uint64_t& entries)
+{
+    const auto start{std::chrono::steady_clock::now()};
+    auto cursor{ctx.read_txn.open_cursor(ctx.read_map)};
+
+    entries = 0;
+    for (auto data{cursor.to_first(/*throw_notfound=*/false)}; data.done; data = cursor.to_next(/*throw_notfound=*/false)) {
+        ++entries;
+    }
+
+    return std::chrono::steady_clock::now() - start;
+}
+
+MDBXWrapper::MDBXWrapper(const DBParams& params)
+    : CDBWrapperBase(params),
+    m_db_context{std::make_unique<MDBXContext>()},
+    m_max_txn_dirty_bytes{params.options.max_txn_dirty_bytes},
+    m_max_reader_lag{params.options.max_reader_lag},
+    m_async_read_threads{std::max<size_t>(1, params.options.async_read_threads)},
+    m_maintain_set_stats{params.options.maintain_set_stats}
+{
+    OpenContext(DBContext(), params.path);
+
+    // Emptying the map frees its pages in one go, unlike deleting the keys one
+    // by one, and leaves the environment directory and its files in place.
+    if (params.wipe_data) {
+        std::cout << "Wiping MDBX in " << PathToString(params.path) << std::endl;
+        MDBXContext& ctx{DBContext()};
+        ctx.read_txn.reset_reading();
+        auto txn{ctx.env.start_write()};
+        txn.clear_map(txn.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single));
+        txn.commit();
+        ctx.read_txn.renew_reading();
+    }
+
+    if (const auto partial{PartialBatches()}; !partial.empty()) {
+        std::cout << "Warning: " << m_name << " holds " << partial.size() << " partially committed batch(es), "
+                  << "a previous flush was interrupted in txn " << partial.back() << std::endl;
+    }
+
+    if (params.value_codec != 0) {
+        m_codec = CodecForTag(params.value_codec);
+        if (!m_codec) {
+            throw dbwrapper_error("Unknown value codec " + std::to_string(params.value_codec));
+        }
+    }
+    LoadValueFormat();
+    LoadSetStats();
+
+    if (params.options.force_compact) {
+        const MDBXCompactStats stats{Compact()};
+        using ms = std::chrono::milliseconds;
+        std::cout << "Compacted " << m_name << " (" << stats.entries << " entries): "
+                  << stats.file_bytes_before << " -> " << stats.file_bytes_after << " bytes, full scan "
+                  << std::chrono::duration_cast<ms>(stats.scan_time_before).count() << "ms -> "
+                  << std::chrono::duration_cast<ms>(stats.scan_time_after).count() << "ms" << std::endl;
+    }
 };
 
 MDBXWrapper::~MDBXWrapper() = default;
@@ -56,34 +393,584 @@ void MDBXWrapper::Sync()
     DBContext().env.sync_to_disk();
 }
 
-std::optional<std::string> MDBXWrapper::ReadImpl(std::span<const std::byte> key) const
+MDBXCompactStats MDBXWrapper::Compact()
+{
+    MDBXContext& ctx{DBContext()};
+    const std::filesystem::path data_file{m_path / MDBX_DATA_FILE};
+    const std::filesystem::path compact_file{m_path / (std::string{MDBX_DATA_FILE} + ".compact")};
+
+    // Left behind by an interrupted compaction, the live data file is intact.
+    std::filesystem::remove(compact_file);
+
+    MDBXCompactStats stats;
+    stats.file_bytes_before = std::filesystem::file_size(data_file);
+    stats.scan_time_before = TimeFullScan(ctx, stats.entries);
+
+    // The copy runs its own read txn on this thread, so ours has to step aside.
+    ctx.read_txn.reset_reading();
+    try {
+        ctx.env.copy(compact_file, /*compactify=*/true, /*force_dynamic_size=*/true);
+    }
+    catch (const std::exception& e) {
+        std::filesystem::remove(compact_file);
+        ctx.read_txn.renew_reading();
+        const std::string errmsg = "Fatal MDBX error while compacting: " + std::string{e.what()};
+        std::cout << errmsg << std::endl;
+        throw dbwrapper_error(errmsg);
+    }
+
+    // rename(2) replaces the data file atomically, so a crash leaves either
+    // the old or the compacted file in place, never a mix of both.
+    ctx.Close();
+    std::filesystem::rename(compact_file, data_file);
+    OpenContext(ctx, m_path);
+
+    uint64_t entries_after{0};
+    stats.file_bytes_after = std::filesystem::file_size(data_file);
+    stats.scan_time_after = TimeFullScan(ctx, entries_after);
+    assert(entries_after == stats.entries);
+
+    return stats;
+}
+
+std::vector<uint64_t> MDBXWrapper::PartialBatches() const
+{
+    const mdbx::slice slPrefix(MDBX_PARTIAL_BATCH_PREFIX.data(), MDBX_PARTIAL_BATCH_PREFIX.size());
+    std::vector<uint64_t> txn_ids;
+    auto cursor{DBContext().read_txn.open_cursor(DBContext().read_map)};
+    for (auto data{cursor.lower_bound(slPrefix, /*throw_notfound=*/false)};
+         data.done && data.key.starts_with(slPrefix) && data.key.size() == slPrefix.size() + 8;
+         data = cursor.to_next(/*throw_notfound=*/false)) {
+        uint64_t txn_id{0};
+        for (size_t i = slPrefix.size(); i < data.key.size(); ++i) {
+            txn_id = (txn_id << 8) | data.key.byte_ptr()[i];
+        }
+        txn_ids.push_back(txn_id);
+    }
+    return txn_ids;
+}
+
+void MDBXWrapper::ClearPartialBatches()
+{
+    const mdbx::slice slPrefix(MDBX_PARTIAL_BATCH_PREFIX.data(), MDBX_PARTIAL_BATCH_PREFIX.size());
+    MDBXContext& ctx{DBContext()};
+    ctx.read_txn.reset_reading();
+    auto txn{ctx.env.start_write()};
+    auto map{txn.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single)};
+    auto cursor{txn.open_cursor(map)};
+    for (auto data{cursor.lower_bound(slPrefix, /*throw_notfound=*/false)};
+         data.done && data.key.starts_with(slPrefix);
+         data = cursor.lower_bound(slPrefix, /*throw_notfound=*/false)) {
+        cursor.erase();
+    }
+    cursor.close();
+    txn.commit();
+    ctx.read_txn.renew_reading();
+}
+
+void MDBXWrapper::LoadSetStats()
+{
+    MDBXContext& ctx{DBContext()};
+    if (HasKey(ctx, MDBX_SET_STATS_KEY) == m_maintain_set_stats) {
+        return;
+    }
+
+    ctx.read_txn.reset_reading();
+    auto txn{ctx.env.start_write()};
+    auto map{txn.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single)};
+    if (m_maintain_set_stats) {
+        // Once, for a database that was written without maintaining them.
+        std::cout << "Computing set statistics of " << m_name << std::endl;
+        MDBXSetStatsState stats;
+        auto cursor{txn.open_cursor(map)};
+        for (auto data{cursor.to_first(/*throw_notfound=*/false)}; data.done; data = cursor.to_next(/*throw_notfound=*/false)) {
+            if (IsReservedKey(data.key)) continue;
+            stats.Update(std::as_bytes(data.key.bytes()), LogicalValue(data.value, m_tagged_values, stats.old_value), /*insert=*/true);
+        }
+        cursor.close();
+        WriteSetStats(txn, map, stats);
+    } else {
+        // Batches no longer update them, so they would go stale.
+        txn.erase(map, mdbx::slice(MDBX_SET_STATS_KEY.data(), MDBX_SET_STATS_KEY.size()));
+    }
+    txn.commit();
+    ctx.read_txn.renew_reading();
+}
+
+std::optional<MDBXSetStats> MDBXWrapper::GetSetStats() const
+{
+    MDBXSetStatsState state;
+    if (!ReadSetStats(DBContext().read_txn, DBContext().read_map, state)) {
+        return std::nullopt;
+    }
+    return MDBXSetStats{.hash = state.hash.Finalize(), .entries = state.entries, .value_bytes = state.value_bytes};
+}
+
+void MDBXWrapper::LoadValueFormat()
+{
+    MDBXContext& ctx{DBContext()};
+    m_tagged_values = HasKey(ctx, MDBX_VALUE_FORMAT_KEY);
+    if (m_tagged_values || !m_codec) {
+        return;
+    }
+
+    // Untagged values cannot be told apart from tagged ones, so tagging can only start on an empty database.
+    if (!IsEmpty()) {
+        std::cout << "Warning: " << m_name << " holds untagged values, value compression is disabled" << std::endl;
+        return;
+    }
+
+    ctx.read_txn.reset_reading();
+    auto txn{ctx.env.start_write()};
+    auto map{txn.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single)};
+    txn.upsert(map, mdbx::slice(MDBX_VALUE_FORMAT_KEY.data(), MDBX_VALUE_FORMAT_KEY.size()), mdbx::slice("1", 1));
+    txn.commit();
+    ctx.read_txn.renew_reading();
+    m_tagged_values = true;
+}
+
+MDBXSnapshotStats MDBXWrapper::DumpSnapshot(const std::filesystem::path& file, const MDBXProgressFn& progress)
+{
+    MDBXContext& ctx{DBContext()};
+    const auto start{std::chrono::steady_clock::now()};
+
+    RenewReader();
+    const uint64_t total{ctx.read_txn.get_map_stat(ctx.read_map).ms_entries};
+
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> out{std::fopen(file.c_str(), "wb"), &std::fclose};
+    if (!out) {
+        throw dbwrapper_error("Failed to create snapshot file: " + PathToString(file));
+    }
+    std::setvbuf(out.get(), nullptr, _IOFBF, 1 << 20);
+
+    // Rewritten with the final counts once all entries are out.
+    MDBXSnapshotHeader header{};
+    std::memcpy(header.magic, MDBX_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = MDBX_SNAPSHOT_VERSION;
+    std::fwrite(&header, sizeof(header), 1, out.get());
+
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> sha{EVP_MD_CTX_new(), &EVP_MD_CTX_free};
+    if (!sha || EVP_DigestInit_ex(sha.get(), EVP_sha256(), nullptr) != 1) {
+        throw dbwrapper_error("Failed to initialize snapshot checksum");
+    }
+    auto put = [&](const void* data, size_t size) {
+        std::fwrite(data, 1, size, out.get());
+        EVP_DigestUpdate(sha.get(), data, size);
+    };
+
+    MDBXSnapshotStats stats;
+    auto cursor{ctx.read_txn.open_cursor(ctx.read_map)};
+    const mdbx::slice slValueFormat(MDBX_VALUE_FORMAT_KEY.data(), MDBX_VALUE_FORMAT_KEY.size());
+    for (auto data{cursor.to_first(/*throw_notfound=*/false)}; data.done; data = cursor.to_next(/*throw_notfound=*/false)) {
+        // Bookkeeping describes this environment, not the data, except for the
+        // value format that the exported values are stored in.
+        if (IsReservedKey(data.key) && data.key != slValueFormat) continue;
+
+        const uint32_t sizes[2]{static_cast<uint32_t>(data.key.size()), static_cast<uint32_t>(data.value.size())};
+        // Keys and values go straight from the memory map to the output buffer.
+        put(sizes, sizeof(sizes));
+        put(data.key.data(), data.key.size());
+        put(data.value.data(), data.value.size());
+
+        stats.bytes += sizeof(sizes) + data.key.size() + data.value.size();
+        if (++stats.entries % MDBX_PROGRESS_INTERVAL == 0 && progress) {
+            progress(stats.entries, total);
+        }
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size{0};
+    EVP_DigestFinal_ex(sha.get(), digest, &digest_size);
+    std::fwrite(digest, 1, digest_size, out.get());
+
+    header.entries = stats.entries;
+    header.payload_bytes = stats.bytes;
+    std::fseek(out.get(), 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, out.get());
+
+    if (std::fflush(out.get()) != 0 || std::ferror(out.get()) || fsync(fileno(out.get())) != 0) {
+        throw dbwrapper_error("Failed to write snapshot file: " + PathToString(file));
+    }
+
+    if (progress) {
+        progress(stats.entries, total);
+    }
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    return stats;
+}
+
+MDBXSnapshotStats MDBXWrapper::LoadSnapshot(const std::filesystem::path& file, const MDBXProgressFn& progress)
+{
+    MDBXContext& ctx{DBContext()};
+    const auto start{std::chrono::steady_clock::now()};
+
+    const int fd{open(file.c_str(), O_RDONLY)};
+    if (fd < 0) {
+        throw dbwrapper_error("Failed to open snapshot file: " + PathToString(file));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw dbwrapper_error("Failed to open snapshot file: " + PathToString(file));
+    }
+    const size_t file_size = st.st_size;
+    constexpr size_t digest_size{32};
+    if (file_size < sizeof(MDBXSnapshotHeader) + digest_size) {
+        close(fd);
+        throw dbwrapper_error("Snapshot file is truncated: " + PathToString(file));
+    }
+    void* map{mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    close(fd);
+    if (map == MAP_FAILED) {
+        throw dbwrapper_error("Failed to map snapshot file: " + PathToString(file));
+    }
+    const std::unique_ptr<void, std::function<void(void*)>> unmap{map, [file_size](void* p) { munmap(p, file_size); }};
+    madvise(map, file_size, MADV_SEQUENTIAL);
+    const std::byte* data{static_cast<const std::byte*>(map)};
+
+    MDBXSnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, MDBX_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != MDBX_SNAPSHOT_VERSION) {
+        throw dbwrapper_error("Not a version " + std::to_string(MDBX_SNAPSHOT_VERSION) + " snapshot file: " + PathToString(file));
+    }
+    if (header.payload_bytes != file_size - sizeof(header) - digest_size) {
+        throw dbwrapper_error("Snapshot file is truncated: " + PathToString(file));
+    }
+
+    const std::byte* payload{data + sizeof(header)};
+    const std::byte* payload_end{payload + header.payload_bytes};
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int computed_size{0};
+    if (EVP_Digest(payload, header.payload_bytes, digest, &computed_size, EVP_sha256(), nullptr) != 1 ||
+        computed_size != digest_size || std::memcmp(digest, payload_end, digest_size) != 0) {
+        throw dbwrapper_error("Snapshot checksum mismatch: " + PathToString(file));
+    }
+
+    // Check the framing and entry count before anything is written, so that a
+    // file that disagrees with its header leaves the database untouched.
+    uint64_t entries{0};
+    for (const std::byte* pos{payload}; pos < payload_end; ++entries) {
+        uint32_t sizes[2];
+        if (payload_end - pos < static_cast<ptrdiff_t>(sizeof(sizes))) {
+            throw dbwrapper_error("Malformed snapshot entry");
+        }
+        std::memcpy(sizes, pos, sizeof(sizes));
+        pos += sizeof(sizes);
+        if (static_cast<size_t>(payload_end - pos) < size_t{sizes[0]} + sizes[1]) {
+            throw dbwrapper_error("Malformed snapshot entry");
+        }
+        pos += sizes[0] + sizes[1];
+    }
+    if (entries != header.entries) {
+        throw dbwrapper_error("Snapshot holds " + std::to_string(entries) + " entries, header claims " + std::to_string(header.entries));
+    }
+
+    if (!IsEmpty()) {
+        throw dbwrapper_error("A snapshot can only be loaded into an empty database");
+    }
+
+    MDBXSnapshotStats stats;
+    ctx.read_txn.reset_reading();
+    try {
+        auto txn{ctx.env.start_write()};
+        auto txn_map{txn.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single)};
+        size_t txn_bytes{0};
+
+        // Append mode only accepts keys beyond the last one already stored.
+        // Bookkeeping entries of the empty database are replaced by the snapshot's.
+        txn.clear_map(txn_map);
+
+        for (const std::byte* pos{payload}; pos < payload_end;) {
+            uint32_t sizes[2];
+            std::memcpy(sizes, pos, sizeof(sizes));
+            pos += sizeof(sizes);
+
+            // Slices point into the mapped file, nothing is copied on the way in.
+            mdbx::slice slKey(pos, sizes[0]);
+            mdbx::slice slValue(pos + sizes[0], sizes[1]);
+            txn.append(txn_map, slKey, slValue);
+            pos += sizes[0] + sizes[1];
+
+            const size_t entry_bytes{sizeof(sizes) + sizes[0] + sizes[1]};
+            stats.bytes += entry_bytes;
+            txn_bytes += entry_bytes;
+            if (txn_bytes >= MDBX_BULK_TXN_BYTES) {
+                txn.commit();
+                txn = ctx.env.start_write();
+                txn_map = txn.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single);
+                txn_bytes = 0;
+            }
+
+            if (++stats.entries % MDBX_PROGRESS_INTERVAL == 0 && progress) {
+                progress(stats.entries, header.entries);
+            }
+        }
+        txn.commit();
+    }
+    catch (const std::exception& e) {
+        ctx.read_txn.renew_reading();
+        const std::string errmsg = "Fatal MDBX error while loading snapshot: " + std::string{e.what()};
+        std::cout << errmsg << std::endl;
+        throw dbwrapper_error(errmsg);
+    }
+    ctx.read_txn.renew_reading();
+
+    // The snapshot brings its own value format, and may lack set statistics.
+    LoadValueFormat();
+    LoadSetStats();
+
+    if (progress) {
+        progress(stats.entries, header.entries);
+    }
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    return stats;
+}
+
+void MDBXWrapper::RenewReader()
+{
+    DBContext().read_txn.reset_reading();
+    DBContext().read_txn.renew_reading();
+}
+
+// Lookups shared by the wrapper's own read txn and by snapshots.
+static std::optional<std::string> ReadFrom(const mdbx::txn& txn, mdbx::map_handle map, std::span<const std::byte> key, bool tagged_values)
 {
     mdbx::slice slKey(CharCast(key.data()), key.size()), slValue;
-    slValue = DBContext().read_txn.get(DBContext().read_map, slKey, mdbx::slice::invalid());
-    
+    slValue = txn.get(map, slKey, mdbx::slice::invalid());
+
     if(slValue == mdbx::slice::invalid()) {
             return std::nullopt;
     }
+    else if (tagged_values && !IsReservedKey(slKey)) {
+        std::string value;
+        if (!DecodeValue(std::as_bytes(slValue.bytes()), value)) {
+            throw dbwrapper_error("Undecodable value");
+        }
+        return value;
+    }
     else {
         return std::string(slValue.as_string());
     }
+}
+
+static bool ExistsIn(const mdbx::txn& txn, mdbx::map_handle map, std::span<const std::byte> key)
+{
+    mdbx::slice slKey(CharCast(key.data()), key.size());
+    return txn.get(map, slKey, mdbx::slice::invalid()) != mdbx::slice::invalid();
+}
 
-    assert(-1);
+std::optional<std::string> MDBXWrapper::ReadImpl(std::span<const std::byte> key) const
+{
+    return ReadFrom(DBContext().read_txn, DBContext().read_map, key, m_tagged_values);
 }
 
 bool MDBXWrapper::ExistsImpl(std::span<const std::byte> key) const
 {
-    mdbx::slice slKey(CharCast(key.data()), key.size()), slValue;
-    slValue = DBContext().read_txn.get(DBContext().read_map, slKey, mdbx::slice::invalid());
-    
-    if(slValue == mdbx::slice::invalid()) {
-            return false;
+    return ExistsIn(DBContext().read_txn, DBContext().read_map, key);
+}
+
+void MDBXReadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    m_submitter = std::this_thread::get_id();
+    m_db.SubmitAsyncRead(*this);
+}
+
+std::optional<std::string> MDBXReadAwaitable::await_resume()
+{
+    // The pages were just prefetched, so this lookup does not fault.
+    return m_db.ReadImpl(m_key);
+}
+
+void MDBXWrapper::SubmitAsyncRead(MDBXReadAwaitable& read) const
+{
+    MDBXReadPool& pool{DBContext().read_pool};
+    {
+        std::lock_guard<std::mutex> lock{pool.mutex};
+        if (pool.workers.empty()) {
+            for (size_t i = 0; i < m_async_read_threads; i++) {
+                pool.workers.emplace_back([this] { PrefetchAsyncReads(); });
+            }
+        }
+        pool.queue.push_back(&read);
+        pool.submitters[read.m_submitter].outstanding++;
     }
-    else {
-        return true;
+    pool.cv.notify_one();
+}
+
+void MDBXWrapper::PrefetchAsyncReads() const
+{
+    MDBXContext& ctx{DBContext()};
+    MDBXReadPool& pool{ctx.read_pool};
+    const uintptr_t page_mask{~(static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1)};
+
+    // Parked between reads, so that an idle thread does not pin old pages.
+    mdbx::txn_managed txn{ctx.env.start_read()};
+    txn.reset_reading();
+
+    while (true) {
+        MDBXReadAwaitable* read;
+        {
+            std::unique_lock<std::mutex> lock{pool.mutex};
+            pool.cv.wait(lock, [&] { return pool.stop || !pool.queue.empty(); });
+            if (pool.queue.empty()) break;
+            read = pool.queue.front();
+            pool.queue.pop_front();
+        }
+
+        // Descending to the key faults in the branch and leaf pages on its
+        // path. A value too large for its leaf lives on overflow pages, which
+        // are requested from the kernel in one go instead of faulted one by one.
+        txn.renew_reading();
+        try {
+            const mdbx::slice slValue{txn.get(ctx.read_map, mdbx::slice(CharCast(read->m_key.data()), read->m_key.size()), mdbx::slice::invalid())};
+            if (slValue != mdbx::slice::invalid() && slValue.size() > 0) {
+                const uintptr_t begin{reinterpret_cast<uintptr_t>(slValue.data()) & page_mask};
+                const uintptr_t end{reinterpret_cast<uintptr_t>(slValue.data()) + slValue.size()};
+                madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+            }
+        } catch (const std::exception&) {
+            // Only a prefetch, the read itself reports the error.
+        }
+        txn.reset_reading();
+
+        {
+            std::lock_guard<std::mutex> lock{pool.mutex};
+            pool.submitters[read->m_submitter].ready.push_back(read);
+        }
+        pool.ready_cv.notify_all();
+    }
+
+    txn.abort();
+}
+
+size_t MDBXWrapper::RunAsyncReads() const
+{
+    MDBXReadPool& pool{DBContext().read_pool};
+    const std::thread::id self{std::this_thread::get_id()};
+    size_t resumed{0};
+
+    while (true) {
+        MDBXReadAwaitable* read;
+        {
+            std::unique_lock<std::mutex> lock{pool.mutex};
+            // Nodes of an unordered_map stay put while other threads add theirs.
+            MDBXReadPool::Submitter& submitter{pool.submitters[self]};
+            pool.ready_cv.wait(lock, [&] { return !submitter.ready.empty() || submitter.outstanding == 0; });
+            if (submitter.ready.empty()) {
+                pool.submitters.erase(self);
+                break;
+            }
+            read = submitter.ready.front();
+            submitter.ready.pop_front();
+            submitter.outstanding--;
+        }
+
+        // The coroutine may finish and free read before resume() returns.
+        read->m_handle.resume();
+        resumed++;
+    }
+    return resumed;
+}
+
+std::shared_ptr<MDBXSnapshotState> MDBXWrapper::OpenSnapshot(MDBXSnapshotPolicy policy) const
+{
+    MDBXContext& ctx{DBContext()};
+    auto state{std::make_shared<MDBXSnapshotState>(policy, m_tagged_values, m_max_reader_lag)};
+    state->txn = ctx.env.start_read();
+    state->map = ctx.read_map;
+
+    std::lock_guard<std::mutex> lock{ctx.snapshots_mutex};
+    std::erase_if(ctx.snapshots, [](const auto& weak) { return weak.expired(); });
+    ctx.snapshots.push_back(state);
+    return state;
+}
+
+void MDBXWrapper::ManageSnapshots() const
+{
+    MDBXContext& ctx{DBContext()};
+    std::lock_guard<std::mutex> lock{ctx.snapshots_mutex};
+    std::erase_if(ctx.snapshots, [](const auto& weak) { return weak.expired(); });
+
+    for (const auto& weak : ctx.snapshots) {
+        const auto state{weak.lock()};
+        if (!state) continue;
+        std::lock_guard<std::mutex> state_lock{state->mutex};
+        if (state->parked) continue;
+
+        // Iterators may still be reading spans into the txn's pages.
+        if (state->live_iterators > 0) continue;
+
+        if (state->policy == MDBXSnapshotPolicy::FOLLOW) {
+            state->txn.reset_reading();
+            state->txn.renew_reading();
+            continue;
+        }
+
+        if (const uint64_t lag{state->ParkIfLagging()}) {
+            std::cout << "Warning: parked a reader of " << m_name << " that lagged " << lag << " commits behind" << std::endl;
+        }
+    }
+}
+
+std::unique_ptr<MDBXSnapshot> MDBXWrapper::NewSnapshot(MDBXSnapshotPolicy policy) const
+{
+    return std::make_unique<MDBXSnapshot>(*this, OpenSnapshot(policy));
+}
+
+MDBXSnapshot::MDBXSnapshot(const MDBXWrapper& parent, std::shared_ptr<MDBXSnapshotState> state)
+    : m_parent{parent}, m_state{std::move(state)} {}
+
+MDBXSnapshot::~MDBXSnapshot() = default;
+
+static void CheckNotParked(const MDBXSnapshotState& state)
+{
+    if (state.parked) {
+        throw dbwrapper_error("Snapshot was parked for lagging too far behind");
     }
+}
 
-    assert(-1);
+std::optional<std::string> MDBXSnapshot::ReadImpl(std::span<const std::byte> key) const
+{
+    std::lock_guard<std::mutex> lock{m_state->mutex};
+    CheckNotParked(*m_state);
+    return ReadFrom(m_state->txn, m_state->map, key, m_state->tagged_values);
+}
+
+bool MDBXSnapshot::ExistsImpl(std::span<const std::byte> key) const
+{
+    std::lock_guard<std::mutex> lock{m_state->mutex};
+    CheckNotParked(*m_state);
+    return ExistsIn(m_state->txn, m_state->map, key);
+}
+
+void MDBXSnapshot::Renew()
+{
+    std::lock_guard<std::mutex> lock{m_state->mutex};
+    if (m_state->live_iterators) {
+        throw dbwrapper_error("Cannot renew a snapshot with open iterators");
+    }
+    if (!m_state->txn) {
+        throw dbwrapper_error("Cannot renew a snapshot whose environment was closed");
+    }
+    if (!m_state->parked) {
+        m_state->txn.reset_reading();
+    }
+    m_state->txn.renew_reading();
+    m_state->parked = false;
+}
+
+bool MDBXSnapshot::IsParked() const
+{
+    std::lock_guard<std::mutex> lock{m_state->mutex};
+    return m_state->parked;
+}
+
+uint64_t MDBXSnapshot::Lag() const
+{
+    std::lock_guard<std::mutex> lock{m_state->mutex};
+    CheckNotParked(*m_state);
+    return m_state->txn.get_info().txn_reader_lag;
 }
 
 size_t MDBXWrapper::EstimateSizeImpl(std::span<const std::byte> key1, std::span<const std::byte> key2) const
@@ -96,8 +983,25 @@ size_t MDBXWrapper::EstimateSizeImpl(std::span<const std::byte> key1, std::span<
 bool MDBXWrapper::WriteBatch(CDBBatchBase& _batch, bool fSync)
 {
     MDBXBatch& batch = static_cast<MDBXBatch&>(_batch);
+
+    if (batch.m_impl_batch->stats) {
+        WriteSetStats(batch.m_impl_batch->txn, batch.m_impl_batch->map, *batch.m_impl_batch->stats);
+    }
+
+    // The last part of a split batch clears the marker left by the first.
+    if (!batch.m_partial_key.empty()) {
+        batch.m_impl_batch->txn.erase(batch.m_impl_batch->map, mdbx::slice(batch.m_partial_key.data(), batch.m_partial_key.size()));
+        batch.m_partial_key.clear();
+    }
     batch.m_impl_batch->txn.commit();
 
+    // Let reads see the commit right away, even if the batch is reused.
+    if (batch.m_reader_paused) {
+        DBContext().read_txn.renew_reading();
+        batch.m_reader_paused = false;
+    }
+    ManageSnapshots();
+
     if(fSync) {
         Sync();
     }
@@ -115,20 +1019,67 @@ bool MDBXWrapper::IsEmpty()
 {
     auto cursor{DBContext().read_txn.open_cursor(DBContext().read_map)};
 
-    // the done parameter indicates whether or not the cursor move succeeded.
-    return cursor.to_first(/*throw_notfound=*/false).done;
+    cursor.to_first(/*throw_notfound=*/false);
+    SkipReserved(cursor);
+    return cursor.eof();
 }
 
-MDBXBatch::MDBXBatch (const CDBWrapperBase& _parent) : CDBBatchBase(_parent)
+MDBXBatch::MDBXBatch (const CDBWrapperBase& _parent, bool pause_reader) : CDBBatchBase(_parent), m_pause_reader{pause_reader}
 {
-    const MDBXWrapper& parent = static_cast<const MDBXWrapper&>(m_parent);
     m_impl_batch = std::make_unique<MDBXWriteBatchImpl>();
+    BeginTxn();
+};
+
+void MDBXBatch::BeginTxn()
+{
+    const MDBXWrapper& parent = static_cast<const MDBXWrapper&>(m_parent);
+
+    if (m_pause_reader && !m_reader_paused) {
+        parent.DBContext().read_txn.reset_reading();
+        m_reader_paused = true;
+    }
 
-    parent.DBContext().read_txn.reset_reading();
     // MDBXBatch is a wrapper for LMDB/MDBX's txn
     m_impl_batch->txn = parent.DBContext().env.start_write();
     m_impl_batch->map = m_impl_batch->txn.create_map(nullptr, mdbx::key_mode::usual, mdbx::value_mode::single);
-};
+
+    if (parent.m_maintain_set_stats) {
+        m_impl_batch->stats = std::make_unique<MDBXSetStatsState>();
+        ReadSetStats(m_impl_batch->txn, m_impl_batch->map, *m_impl_batch->stats);
+    }
+}
+
+size_t MDBXBatch::DirtyBytes() const
+{
+    return m_impl_batch->txn.get_info().txn_space_dirty;
+}
+
+void MDBXBatch::MaybeSplit()
+{
+    const MDBXWrapper& parent = static_cast<const MDBXWrapper&>(m_parent);
+    if (parent.m_max_txn_dirty_bytes == 0 || DirtyBytes() < parent.m_max_txn_dirty_bytes) {
+        return;
+    }
+
+    // Until the last part is committed the database holds a mix of old and
+    // new state, leave a marker so that an interruption can be detected.
+    if (m_partial_key.empty()) {
+        // Big endian, so that markers sort in the order they were written.
+        const uint64_t txn_id{m_impl_batch->txn.id()};
+        m_partial_key = MDBX_PARTIAL_BATCH_PREFIX;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            m_partial_key.push_back(static_cast<char>(txn_id >> shift));
+        }
+        m_impl_batch->txn.upsert(m_impl_batch->map, mdbx::slice(m_partial_key.data(), m_partial_key.size()), mdbx::slice("1", 1));
+    }
+    // Each part commits the statistics of the state it leaves behind.
+    if (m_impl_batch->stats) {
+        WriteSetStats(m_impl_batch->txn, m_impl_batch->map, *m_impl_batch->stats);
+    }
+    m_impl_batch->txn.commit();
+    parent.ManageSnapshots();
+    BeginTxn();
+}
 
 MDBXBatch::~MDBXBatch()
 {
@@ -137,12 +1088,20 @@ MDBXBatch::~MDBXBatch()
     }
     const MDBXWrapper& parent = static_cast<const MDBXWrapper&>(m_parent);
 
-    parent.DBContext().read_txn.renew_reading();
+    if (m_reader_paused) {
+        parent.DBContext().read_txn.renew_reading();
+    }
 }
 
 void MDBXBatch::Clear()
 {
-    m_impl_batch->txn.abort();
+    if (m_impl_batch->txn) {
+        m_impl_batch->txn.abort();
+    }
+    // Parts of a split batch that were already committed stay, as does their
+    // marker, until the caller calls ClearPartialBatches().
+    m_partial_key.clear();
+    BeginTxn();
     size_estimate = 0;
 }
 
@@ -152,6 +1111,24 @@ void MDBXBatch::WriteImpl(std::span<const std::byte> key, DataStream& ssValue)
     //ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
     mdbx::slice slValue(CharCast(ssValue.data()), ssValue.size());
 
+    const MDBXWrapper& parent = static_cast<const MDBXWrapper&>(m_parent);
+    // Bookkeeping entries are stored as is, like those written directly by the wrapper.
+    if (parent.m_tagged_values && !IsReservedKey(slKey)) {
+        EncodeValue(parent.m_codec, ssValue, m_impl_batch->encoded);
+        slValue = mdbx::slice(CharCast(m_impl_batch->encoded.data()), m_impl_batch->encoded.size());
+    }
+
+    // Bookkeeping entries are not part of the set, as in LoadSetStats().
+    auto& stats{m_impl_batch->stats};
+    if (stats && !IsReservedKey(slKey)) {
+        // An overwritten entry leaves the set.
+        const mdbx::slice slOld{m_impl_batch->txn.get(m_impl_batch->map, slKey, mdbx::slice::invalid())};
+        if (slOld != mdbx::slice::invalid()) {
+            stats->Update(key, LogicalValue(slOld, parent.m_tagged_values, stats->old_value), /*insert=*/false);
+        }
+        stats->Update(key, ssValue, /*insert=*/true);
+    }
+
     try {
         m_impl_batch->txn.put(m_impl_batch->map, slKey, slValue, mdbx::put_mode::upsert);
     }
@@ -168,24 +1145,113 @@ void MDBXBatch::WriteImpl(std::span<const std::byte> key, DataStream& ssValue)
     // - varint: value length
     // - byte[]: value
     // The formula below assumes the key and value are both less than 16k.
-    // size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
-} 
+    size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
+
+    MaybeSplit();
+}
 
 void MDBXBatch::EraseImpl(std::span<const std::byte> key)
 {
     mdbx::slice slKey(CharCast(key.data()), key.size());
+
+    auto& stats{m_impl_batch->stats};
+    if (stats && !IsReservedKey(slKey)) {
+        const MDBXWrapper& parent = static_cast<const MDBXWrapper&>(m_parent);
+        const mdbx::slice slOld{m_impl_batch->txn.get(m_impl_batch->map, slKey, mdbx::slice::invalid())};
+        if (slOld != mdbx::slice::invalid()) {
+            stats->Update(key, LogicalValue(slOld, parent.m_tagged_values, stats->old_value), /*insert=*/false);
+        }
+    }
+
     m_impl_batch->txn.erase(m_impl_batch->map, slKey);
     // LevelDB serializes erases as:
     // - byte: header
     // - varint: key length
     // - byte[]: key
     // The formula below assumes the key is less than 16kB.
-    // size_estimate += 2 + (slKey.size() > 127) + slKey.size();
+    size_estimate += 2 + (slKey.size() > 127) + slKey.size();
+
+    MaybeSplit();
+}
+
+void MDBXBatch::EraseRangeImpl(std::span<const std::byte> begin, std::span<const std::byte> end)
+{
+    const MDBXWrapper& parent = static_cast<const MDBXWrapper&>(m_parent);
+    mdbx::slice slBegin(CharCast(begin.data()), begin.size());
+
+    bool more{true};
+    while (more) {
+        more = false;
+        {
+            // The cursor must be gone before MaybeSplit() commits its txn.
+            auto cursor{m_impl_batch->txn.open_cursor(m_impl_batch->map)};
+            size_t erased{0};
+            for (auto data{cursor.lower_bound(slBegin, /*throw_notfound=*/false)};
+                 data.done && KeyBefore(data.key, end);
+                 data = cursor.to_next(/*throw_notfound=*/false)) {
+                if (IsReservedKey(data.key)) continue;
+
+                // Same estimate as EraseImpl.
+                size_estimate += 2 + (data.key.size() > 127) + data.key.size();
+                if (auto& stats{m_impl_batch->stats}) {
+                    stats->Update(std::as_bytes(data.key.bytes()), LogicalValue(data.value, parent.m_tagged_values, stats->old_value), /*insert=*/false);
+                }
+                // Leaves the cursor on the following key, which to_next() returns.
+                cursor.erase();
+
+                if (parent.m_max_txn_dirty_bytes && ++erased % MDBX_ERASE_RANGE_SPLIT_INTERVAL == 0) {
+                    more = true;
+                    break;
+                }
+            }
+        }
+        // Everything before the cursor is erased, so continuing from begin is cheap.
+        MaybeSplit();
+    }
 }
 
 struct MDBXIterator::IteratorImpl {
+    // The snapshot whose txn the cursor reads, kept alive by the iterator.
+    const std::shared_ptr<MDBXSnapshotState> snapshot;
     const std::unique_ptr<mdbx::cursor_managed> cursor;
-    explicit IteratorImpl(mdbx::cursor_managed _cursor) : cursor{std::make_unique<mdbx::cursor_managed>(std::move(_cursor))} {}
+    // Buffer that tagged values are decoded into.
+    mutable std::string value;
+
+    explicit IteratorImpl(std::shared_ptr<MDBXSnapshotState> _snapshot) : snapshot{std::move(_snapshot)},
+        cursor{std::make_unique<mdbx::cursor_managed>()}
+    {
+        std::lock_guard<std::mutex> lock{snapshot->mutex};
+        CheckNotParked(*snapshot);
+        *cursor = snapshot->txn.open_cursor(snapshot->map);
+        ++snapshot->live_iterators;
+    }
+
+    ~IteratorImpl()
+    {
+        std::lock_guard<std::mutex> lock{snapshot->mutex};
+        cursor->close();
+        --snapshot->live_iterators;
+    }
+
+    // Held around every use of the cursor, so the snapshot cannot be parked mid-step.
+    std::unique_lock<std::mutex> Lock() const
+    {
+        std::unique_lock<std::mutex> lock{snapshot->mutex};
+        CheckNotParked(*snapshot);
+        return lock;
+    }
+
+    // Lock before moving the cursor. Spans handed out at the old position
+    // are invalid from here on, so this is where a lagging snapshot is parked.
+    std::unique_lock<std::mutex> StepLock() const
+    {
+        std::unique_lock<std::mutex> lock{snapshot->mutex};
+        if (const uint64_t lag{snapshot->ParkIfLagging()}) {
+            std::cout << "Warning: parked an iterator that lagged " << lag << " commits behind" << std::endl;
+        }
+        CheckNotParked(*snapshot);
+        return lock;
+    }
 };
 
 MDBXIterator::MDBXIterator(const CDBWrapperBase& _parent, std::unique_ptr<IteratorImpl> _piter): CDBIteratorBase(_parent),
@@ -193,38 +1259,61 @@ MDBXIterator::MDBXIterator(const CDBWrapperBase& _parent, std::unique_ptr<Iterat
 
 void MDBXIterator::SeekImpl(std::span<const std::byte> key)
 {
+    const auto lock{m_impl_iter->StepLock()};
     mdbx::slice slKey(CharCast(key.data()), key.size());
-    m_impl_iter->cursor->seek(slKey);
+    // Position at the first key not less than the target, like leveldb's Seek.
+    m_impl_iter->cursor->lower_bound(slKey, /*throw_notfound=*/false);
+    SkipReserved(*m_impl_iter->cursor);
 }
 
 CDBIteratorBase* MDBXWrapper::NewIterator()
 {
-    return new MDBXIterator{*this, std::make_unique<MDBXIterator::IteratorImpl>(DBContext().read_txn.open_cursor(DBContext().read_map))};
+    return new MDBXIterator{*this, std::make_unique<MDBXIterator::IteratorImpl>(OpenSnapshot(MDBXSnapshotPolicy::PIN))};
+}
+
+CDBIteratorBase* MDBXSnapshot::NewIterator() const
+{
+    return new MDBXIterator{m_parent, std::make_unique<MDBXIterator::IteratorImpl>(m_state)};
 }
 
 std::span<const std::byte> MDBXIterator::GetKeyImpl() const
 {
+    const auto lock{m_impl_iter->Lock()};
     return std::as_bytes(m_impl_iter->cursor->current().key.bytes());
 }
 
 std::span<const std::byte> MDBXIterator::GetValueImpl() const
 {
+    const auto lock{m_impl_iter->Lock()};
     // std::as_bytes is necessary since mdbx::slice::bytes() returns a span of `char8_` not std::byte
-    return std::as_bytes(m_impl_iter->cursor->current().value.bytes());
+    const auto stored{std::as_bytes(m_impl_iter->cursor->current().value.bytes())};
+    if (!m_impl_iter->snapshot->tagged_values) {
+        return stored;
+    }
+    if (!DecodeValue(stored, m_impl_iter->value)) {
+        throw dbwrapper_error("Undecodable value");
+    }
+    return std::as_bytes(std::span{m_impl_iter->value});
 }
 
 MDBXIterator::~MDBXIterator() = default;
 
 bool MDBXIterator::Valid() const {
-    return false;
+    const auto lock{m_impl_iter->Lock()};
+    // eof() is also true for a cursor that was never positioned.
+    return !m_impl_iter->cursor->eof();
 }
 
 void MDBXIterator::SeekToFirst()
 {
-    m_impl_iter->cursor->to_first();
+    const auto lock{m_impl_iter->StepLock()};
+    m_impl_iter->cursor->to_first(/*throw_notfound=*/false);
+    SkipReserved(*m_impl_iter->cursor);
 }
 
 void MDBXIterator::Next()
 {
-    m_impl_iter->cursor->to_next();
+    const auto lock{m_impl_iter->StepLock()};
+    m_impl_iter->cursor->to_next(/*throw_notfound=*/false);
+    SkipReserved(*m_impl_iter->cursor);
 }
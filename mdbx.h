@@ -1,6 +1,19 @@
+#ifndef MDBX_WRAPPER_H
+#define MDBX_WRAPPER_H
+
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <mdbx.h>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include "dbwrapper.h"
 
@@ -9,6 +22,14 @@
 
 // MDBXContext is defined in mdbx.cpp to avoid dependency on libmdbx here
 struct MDBXContext;
+struct MDBXSnapshotState;
+class MDBXSnapshot;
+class MDBXWrapper;
+class ValueCodec;
+
+//! Keys starting with this prefix hold the wrapper's own bookkeeping, they are
+//! skipped by iterators and IsEmpty().
+static constexpr std::string_view MDBX_RESERVED_KEY_PREFIX{"\0mdbx/", 6};
 
 /** Batch of changes queued to be written to an MDBXWrapper */
 class MDBXBatch : public CDBBatchBase
@@ -20,16 +41,38 @@ private:
     struct MDBXWriteBatchImpl;
     std::unique_ptr<MDBXWriteBatchImpl> m_impl_batch;
 
+    //! Key of this batch's partial batch marker, set once part of it has been committed.
+    std::string m_partial_key;
+
     void WriteImpl(std::span<const std::byte> key, DataStream& ssValue) override;
     void EraseImpl(std::span<const std::byte> key) override;
+    //! Walks a single cursor over the range, instead of descending from the root for every key.
+    void EraseRangeImpl(std::span<const std::byte> begin, std::span<const std::byte> end) override;
+
+    void BeginTxn();
+    //! Commit what has been written so far if the txn holds too many dirty pages.
+    void MaybeSplit();
+
+    //! Whether the parent's read txn is released while this batch holds a write txn.
+    const bool m_pause_reader;
+    //! Whether the parent's read txn is currently released by this batch.
+    bool m_reader_paused{false};
 
 public:
     /**
-     * @param[in] _parent   CDBWrapper that this batch is to be submitted to
+     * @param[in] _parent       CDBWrapper that this batch is to be submitted to
+     * @param[in] pause_reader  Release the parent's read txn while the batch is
+     *                          open. MDBX does not let a thread hold a read and
+     *                          a write txn at once, so this can only be false
+     *                          for batches built on another thread, whose
+     *                          owner must RenewReader() after committing.
      */
-    explicit MDBXBatch(const CDBWrapperBase& _parent);
+    explicit MDBXBatch(const CDBWrapperBase& _parent, bool pause_reader = true);
     ~MDBXBatch();
     void Clear() override;
+
+    //! Bytes of dirty pages held by the current write txn.
+    size_t DirtyBytes() const;
 };
 
 /** An iterator that maps to MDBX's cursor */
@@ -47,7 +90,7 @@ public:
 public:
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
-     * @param[in] _piter           MDBX iterator.
+     * @param[in] _piter           MDBX iterator, which holds the snapshot it reads.
      */
     MDBXIterator(const CDBWrapperBase& _parent, std::unique_ptr<IteratorImpl> _piter);
     ~MDBXIterator() override;
@@ -57,13 +100,112 @@ public:
     void Next() override;
 };
 
+/** Sizes and full-scan timings taken around an MDBXWrapper::Compact() */
+struct MDBXCompactStats {
+    uint64_t entries{0};
+    uint64_t file_bytes_before{0};
+    uint64_t file_bytes_after{0};
+    std::chrono::nanoseconds scan_time_before{0};
+    std::chrono::nanoseconds scan_time_after{0};
+};
+
+/** Totals of an MDBXWrapper::DumpSnapshot() or LoadSnapshot() */
+struct MDBXSnapshotStats {
+    uint64_t entries{0};
+    //! Bytes of key and value data, including their length prefixes.
+    uint64_t bytes{0};
+    std::chrono::nanoseconds elapsed{0};
+};
+
+/** Statistics of all entries, maintained incrementally by MDBXWrapper */
+struct MDBXSetStats {
+    //! MuHash3072 of every entry's key and value, see MuHash3072::Finalize().
+    std::array<std::byte, 32> hash;
+    uint64_t entries{0};
+    //! Bytes of all values, as serialized before any value codec.
+    uint64_t value_bytes{0};
+};
+
+//! Receives the number of entries processed so far and the total expected.
+using MDBXProgressFn = std::function<void(uint64_t done, uint64_t total)>;
+
+//! How an MDBXSnapshot follows the commits made after it was taken.
+enum class MDBXSnapshotPolicy {
+    //! Keep the view it was taken at until it is renewed or released.
+    PIN,
+    //! Move to the latest commit after every WriteBatch, unless an iterator is open on it.
+    FOLLOW,
+};
+
+/**
+ * Returned by MDBXWrapper::ReadAsync(). Awaiting it queues the key for the
+ * wrapper's prefetch threads, which look it up on a read txn of their own, so
+ * that the pages on its path are faulted in by them rather than by the
+ * caller. Once they are resident, MDBXWrapper::RunAsyncReads() resumes the
+ * coroutine on the thread that awaited it, which reads the value from the
+ * wrapper's own read txn.
+ */
+class MDBXReadAwaitable
+{
+    friend class MDBXWrapper;
+
+private:
+    const MDBXWrapper& m_db;
+    const std::vector<std::byte> m_key;
+    std::coroutine_handle<> m_handle;
+    //! Thread that awaited the read, the only one allowed to resume it.
+    std::thread::id m_submitter;
+
+public:
+    MDBXReadAwaitable(const MDBXWrapper& db, std::span<const std::byte> key) : m_db{db}, m_key(key.begin(), key.end()) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    //! The serialized value, or std::nullopt if the key is absent.
+    std::optional<std::string> await_resume();
+};
+
 class MDBXWrapper : public CDBWrapperBase
 {
     friend class MDBXBatch; // We want MDBXBatch to be able to access the env and sync
                             // Is there a better mechanism than friend class?
+    friend class MDBXSnapshot;
+    friend class MDBXReadAwaitable;
 private:
     std::unique_ptr<MDBXContext> m_db_context;
 
+    //! See DBOptions::max_txn_dirty_bytes.
+    const size_t m_max_txn_dirty_bytes;
+
+    //! Codec used for new values, see DBParams::value_codec.
+    const ValueCodec* m_codec{nullptr};
+    //! Whether stored values carry a codec tag, which is recorded in the database.
+    bool m_tagged_values{false};
+
+    //! See DBOptions::max_reader_lag.
+    const uint64_t m_max_reader_lag;
+    //! See DBOptions::async_read_threads.
+    const size_t m_async_read_threads;
+    //! See DBOptions::maintain_set_stats.
+    const bool m_maintain_set_stats;
+
+    //! Compute the set statistics with a full scan if they are to be maintained
+    //! but are missing, or drop them if they are no longer maintained.
+    void LoadSetStats();
+
+    //! Queue a read for the prefetch threads, starting them if needed.
+    void SubmitAsyncRead(MDBXReadAwaitable& read) const;
+    //! Body of each prefetch thread.
+    void PrefetchAsyncReads() const;
+
+    //! Open a read txn of its own and register it, so that commits renew or park it.
+    std::shared_ptr<MDBXSnapshotState> OpenSnapshot(MDBXSnapshotPolicy policy) const;
+    //! Run after each commit: renew idle FOLLOW snapshots and park lagging ones.
+    void ManageSnapshots() const;
+
+    //! Work out whether values are tagged, and start tagging if a codec is requested for an empty database.
+    void LoadValueFormat();
+
     auto& DBContext() const [[clang::lifetimebound]] {
         assert(m_db_context); return *m_db_context;
     }
@@ -79,14 +221,99 @@ private:
     void Sync();
 
 public:
-    MDBXWrapper(std::filesystem::path path);
+    MDBXWrapper(const DBParams& params);
     ~MDBXWrapper() override;
 
+    /**
+     * Rewrite the environment into a compacted copy with pages in key order,
+     * and swap it in place of the current data file. The copy is made with
+     * dynamic geometry, so it is trimmed down to the pages actually in use.
+     *
+     * The environment is closed and reopened, so this must not be called while
+     * any batch, iterator or snapshot is outstanding.
+     */
+    MDBXCompactStats Compact();
+
+    /**
+     * Return true if a batch that was split over several transactions was
+     * interrupted before its last part was committed.
+     */
+    bool HasPartialBatch() const { return !PartialBatches().empty(); }
+
+    //! Ids of the first txn of each interrupted split batch, oldest first.
+    std::vector<uint64_t> PartialBatches() const;
+
+    /**
+     * Forget the markers of interrupted split batches, once the caller has
+     * recovered from them, so that a later interruption can be told apart.
+     * Must not be called while a batch is outstanding.
+     */
+    void ClearPartialBatches();
+
+    //! Move the shared read txn forward to the latest committed state.
+    void RenewReader();
+
+    /**
+     * Hash, entry count and value bytes of the whole database as of the last
+     * commit, without a scan. std::nullopt unless DBOptions::maintain_set_stats is set.
+     */
+    std::optional<MDBXSetStats> GetSetStats() const;
+
+    /**
+     * Look up a key from a coroutine: `co_await db.ReadAsync(key)` yields the
+     * serialized value, as Read() would once the coroutine resumes. Awaiting
+     * coroutines are resumed by RunAsyncReads(), which must be called on the
+     * thread they awaited on. Reads must not be outstanding when this wrapper
+     * is destroyed or compacted.
+     */
+    template <typename K>
+    MDBXReadAwaitable ReadAsync(const K& key) const
+    {
+        DataStream ssKey{};
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey << key;
+        return MDBXReadAwaitable{*this, ssKey};
+    }
+
+    /**
+     * Resume the coroutines that awaited ReadAsync() on the calling thread,
+     * as their pages are prefetched, until none of them is outstanding,
+     * including reads awaited by the resumed coroutines. Reads awaited on
+     * other threads are left to those threads' own RunAsyncReads().
+     * @returns the number of coroutines resumed.
+     */
+    size_t RunAsyncReads() const;
+
+    /**
+     * Take a consistent view of the database for reads and scans that must
+     * not observe commits made meanwhile. It must be released before this
+     * wrapper is destroyed or compacted.
+     */
+    std::unique_ptr<MDBXSnapshot> NewSnapshot(MDBXSnapshotPolicy policy = MDBXSnapshotPolicy::PIN) const;
+
+    /**
+     * Write the entire keyspace, in key order, to a flat snapshot file: a
+     * header, then each entry as its key and value lengths followed by their
+     * bytes, then a SHA256 of everything after the header. Bookkeeping
+     * entries are left out, apart from the value format.
+     */
+    MDBXSnapshotStats DumpSnapshot(const std::filesystem::path& file, const MDBXProgressFn& progress = {});
+
+    /**
+     * Verify a snapshot written by DumpSnapshot() and load it into this
+     * database, which must be empty. Entries are appended straight from the
+     * mapped file in large transactions, which leaves the pages densely
+     * packed and in key order. If loading fails part way, the transactions
+     * already committed remain, so the database has to be wiped before retrying.
+     */
+    MDBXSnapshotStats LoadSnapshot(const std::filesystem::path& file, const MDBXProgressFn& progress = {});
+
     bool WriteBatch(CDBBatchBase& batch, bool fSync) override;
 
     // Get an estimate of MDBX memory usage (in bytes).
     size_t DynamicMemoryUsage() const override;
 
+    //! The iterator reads a snapshot of its own, unaffected by later batches.
     CDBIteratorBase* NewIterator() override;
 
     /**
@@ -95,3 +322,74 @@ public:
     bool IsEmpty() override;
 };
 
+/**
+ * A read-only view of an MDBXWrapper, backed by an MDBX read txn of its own.
+ * All reads and iterators on a snapshot see the same state, whatever is
+ * committed meanwhile.
+ *
+ * A view pins the pages it can see, so that MDBX cannot reuse them and the
+ * file grows instead. A snapshot that falls more than
+ * DBOptions::max_reader_lag commits behind is parked: its txn is released and
+ * every further use, including by its iterators, throws dbwrapper_error until
+ * it is renewed. While iterators are open on it, a snapshot is only parked by
+ * an iterator about to step, so keys and values they returned stay valid.
+ */
+class MDBXSnapshot
+{
+private:
+    const MDBXWrapper& m_parent;
+    const std::shared_ptr<MDBXSnapshotState> m_state;
+
+    std::optional<std::string> ReadImpl(std::span<const std::byte> key) const;
+    bool ExistsImpl(std::span<const std::byte> key) const;
+
+public:
+    MDBXSnapshot(const MDBXWrapper& parent, std::shared_ptr<MDBXSnapshotState> state);
+    ~MDBXSnapshot();
+
+    MDBXSnapshot(const MDBXSnapshot&) = delete;
+    MDBXSnapshot& operator=(const MDBXSnapshot&) = delete;
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        DataStream ssKey{};
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey << key;
+        std::optional<std::string> strValue{ReadImpl(ssKey)};
+        if (!strValue) {
+            return false;
+        }
+        try {
+            DataStream ssValue{std::as_bytes(std::span{(*strValue)})};
+            ssValue >> value;
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    template <typename K>
+    bool Exists(const K& key) const
+    {
+        DataStream ssKey{};
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey << key;
+        return ExistsImpl(ssKey);
+    }
+
+    //! Iterate over this snapshot's view. The iterator keeps the view alive.
+    CDBIteratorBase* NewIterator() const;
+
+    //! Move to the latest committed state, which also revives a parked
+    //! snapshot. Iterators must not be open on it.
+    void Renew();
+
+    //! Whether the snapshot was parked for lagging too far behind.
+    bool IsParked() const;
+
+    //! Number of commits made since the view was taken.
+    uint64_t Lag() const;
+};
+
+#endif // MDBX_WRAPPER_H
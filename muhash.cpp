@@ -0,0 +1,102 @@
+#include <openssl/evp.h>
+#include <stdexcept>
+
+#include "muhash.h"
+
+// The modulus, 2^3072 - 1103717, the largest 3072-bit safe prime.
+static const BIGNUM* Prime()
+{
+    static const std::unique_ptr<BIGNUM, decltype(&BN_free)> prime{[] {
+        BIGNUM* p{BN_new()};
+        if (!p || !BN_set_bit(p, 3072) || !BN_sub_word(p, 1103717)) {
+            throw std::runtime_error("MuHash3072: failed to set up the prime");
+        }
+        return p;
+    }(), &BN_free};
+    return prime.get();
+}
+
+MuHash3072::MuHash3072()
+    : m_numerator{BN_new()},
+      m_denominator{BN_new()},
+      m_ctx{BN_CTX_new()},
+      m_element{BN_new()}
+{
+    if (!m_numerator || !m_denominator || !m_ctx || !m_element ||
+        !BN_one(m_numerator.get()) || !BN_one(m_denominator.get())) {
+        throw std::runtime_error("MuHash3072: out of memory");
+    }
+}
+
+MuHash3072::~MuHash3072() = default;
+
+void MuHash3072::ToElement(std::span<const std::byte> data)
+{
+    // Like Core: the SHA256 of the data keys a ChaCha20 keystream, and 384
+    // bytes of it are read as a little endian number.
+    unsigned char key[32];
+    unsigned char stream[BYTE_SIZE]{};
+    const unsigned char iv[16]{};
+    int len{0};
+    EVP_CIPHER_CTX* cipher{EVP_CIPHER_CTX_new()};
+    const bool ok{cipher &&
+                  EVP_Digest(data.data(), data.size(), key, nullptr, EVP_sha256(), nullptr) &&
+                  EVP_EncryptInit_ex(cipher, EVP_chacha20(), nullptr, key, iv) &&
+                  EVP_EncryptUpdate(cipher, stream, &len, stream, sizeof(stream))};
+    EVP_CIPHER_CTX_free(cipher);
+    if (!ok || !BN_lebin2bn(stream, sizeof(stream), m_element.get()) ||
+        !BN_nnmod(m_element.get(), m_element.get(), Prime(), m_ctx.get())) {
+        throw std::runtime_error("MuHash3072: failed to hash an element");
+    }
+}
+
+MuHash3072& MuHash3072::Insert(std::span<const std::byte> data)
+{
+    ToElement(data);
+    if (!BN_mod_mul(m_numerator.get(), m_numerator.get(), m_element.get(), Prime(), m_ctx.get())) {
+        throw std::runtime_error("MuHash3072: multiplication failed");
+    }
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(std::span<const std::byte> data)
+{
+    ToElement(data);
+    if (!BN_mod_mul(m_denominator.get(), m_denominator.get(), m_element.get(), Prime(), m_ctx.get())) {
+        throw std::runtime_error("MuHash3072: multiplication failed");
+    }
+    return *this;
+}
+
+std::array<std::byte, 32> MuHash3072::Finalize() const
+{
+    std::unique_ptr<BIGNUM, BNDeleter> result{BN_new()};
+    unsigned char bytes[BYTE_SIZE];
+    std::array<std::byte, 32> hash;
+    if (!result ||
+        !BN_mod_inverse(result.get(), m_denominator.get(), Prime(), m_ctx.get()) ||
+        !BN_mod_mul(result.get(), result.get(), m_numerator.get(), Prime(), m_ctx.get()) ||
+        BN_bn2lebinpad(result.get(), bytes, sizeof(bytes)) != sizeof(bytes) ||
+        !EVP_Digest(bytes, sizeof(bytes), reinterpret_cast<unsigned char*>(hash.data()), nullptr, EVP_sha256(), nullptr)) {
+        throw std::runtime_error("MuHash3072: failed to finalize");
+    }
+    return hash;
+}
+
+void MuHash3072::Serialize(std::span<std::byte, SERIALIZED_SIZE> out) const
+{
+    auto* p{reinterpret_cast<unsigned char*>(out.data())};
+    if (BN_bn2lebinpad(m_numerator.get(), p, BYTE_SIZE) != BYTE_SIZE ||
+        BN_bn2lebinpad(m_denominator.get(), p + BYTE_SIZE, BYTE_SIZE) != BYTE_SIZE) {
+        throw std::runtime_error("MuHash3072: failed to serialize");
+    }
+}
+
+void MuHash3072::Unserialize(std::span<const std::byte, SERIALIZED_SIZE> in)
+{
+    const auto* p{reinterpret_cast<const unsigned char*>(in.data())};
+    if (!BN_lebin2bn(p, BYTE_SIZE, m_numerator.get()) ||
+        !BN_lebin2bn(p + BYTE_SIZE, BYTE_SIZE, m_denominator.get())) {
+        throw std::runtime_error("MuHash3072: failed to unserialize");
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef MUHASH_H
+#define MUHASH_H
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <span>
+
+#include <openssl/bn.h>
+
+/**
+ * A hash of a multiset of byte strings that can be updated incrementally, as
+ * in Bitcoin Core's MuHash3072. Each element is hashed to a number modulo the
+ * prime 2^3072 - 1103717, and the set hash is the product of its elements.
+ * The order of insertions and removals does not change the result.
+ *
+ * Removals are multiplied into a separate denominator, so that the costly
+ * modular inverse is only taken by Finalize().
+ */
+class MuHash3072
+{
+private:
+    struct BNDeleter {
+        void operator()(BIGNUM* bn) const { BN_free(bn); }
+        void operator()(BN_CTX* ctx) const { BN_CTX_free(ctx); }
+    };
+    std::unique_ptr<BIGNUM, BNDeleter> m_numerator;
+    std::unique_ptr<BIGNUM, BNDeleter> m_denominator;
+    std::unique_ptr<BN_CTX, BNDeleter> m_ctx;
+    std::unique_ptr<BIGNUM, BNDeleter> m_element;
+
+    //! Map data to a number modulo the prime, left in m_element.
+    void ToElement(std::span<const std::byte> data);
+
+public:
+    //! Bytes of one number modulo the prime.
+    static constexpr size_t BYTE_SIZE{384};
+    //! Bytes written by Serialize(): the numerator, then the denominator.
+    static constexpr size_t SERIALIZED_SIZE{2 * BYTE_SIZE};
+
+    //! The hash of the empty set.
+    MuHash3072();
+    ~MuHash3072();
+
+    MuHash3072(const MuHash3072&) = delete;
+    MuHash3072& operator=(const MuHash3072&) = delete;
+
+    MuHash3072& Insert(std::span<const std::byte> data);
+    MuHash3072& Remove(std::span<const std::byte> data);
+
+    //! SHA256 of the set hash, as a little endian number.
+    std::array<std::byte, 32> Finalize() const;
+
+    void Serialize(std::span<std::byte, SERIALIZED_SIZE> out) const;
+    void Unserialize(std::span<const std::byte, SERIALIZED_SIZE> in);
+};
+
+#endif // MUHASH_H
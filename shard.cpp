@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "dbwrapper.h"
+#include "mdbx.h"
+#include "shard.h"
+
+// Written to every shard on each commit: the commit epoch followed by the
+// shard count, both little endian.
+static const std::string SHARD_EPOCH_KEY{std::string{MDBX_RESERVED_KEY_PREFIX} + "shard_epoch"};
+static constexpr size_t SHARD_EPOCH_SIZE{sizeof(uint64_t) + sizeof(uint32_t)};
+
+static_assert(std::endian::native == std::endian::little, "shard epoch format assumes a little-endian host");
+
+static std::span<const std::byte> EpochKey()
+{
+    return std::as_bytes(std::span{SHARD_EPOCH_KEY});
+}
+
+template <typename T>
+static void WriteLE(DataStream& s, T v)
+{
+    s.write(std::as_bytes(std::span{&v, 1}));
+}
+
+//
+// ShardedBatch
+//
+
+ShardedBatch::ShardedBatch(const ShardedWrapper& _parent)
+    : CDBBatchBase(_parent),
+    m_ops(_parent.m_shards.size())
+{
+}
+
+void ShardedBatch::Clear()
+{
+    for (auto& ops : m_ops) {
+        ops.clear();
+    }
+    size_estimate = 0;
+}
+
+void ShardedBatch::WriteImpl(std::span<const std::byte> key, DataStream& ssValue)
+{
+    const ShardedWrapper& parent = static_cast<const ShardedWrapper&>(m_parent);
+    m_ops[parent.ShardIndex(key)].push_back(ShardOp{OpType::WRITE, {key.begin(), key.end()}, ssValue});
+
+    // Same LevelDB-equivalent estimate as MDBXBatch.
+    size_estimate += 3 + (key.size() > 127) + key.size() + (ssValue.size() > 127) + ssValue.size();
+}
+
+void ShardedBatch::EraseImpl(std::span<const std::byte> key)
+{
+    const ShardedWrapper& parent = static_cast<const ShardedWrapper&>(m_parent);
+    m_ops[parent.ShardIndex(key)].push_back(ShardOp{OpType::ERASE, {key.begin(), key.end()}, DataStream{}});
+
+    size_estimate += 2 + (key.size() > 127) + key.size();
+}
+
+void ShardedBatch::EraseRangeImpl(std::span<const std::byte> begin, std::span<const std::byte> end)
+{
+    for (auto& ops : m_ops) {
+        ops.push_back(ShardOp{OpType::ERASE_RANGE, {begin.begin(), begin.end()}, DataStream{end}});
+    }
+    // Only the range itself is counted, the number of keys is not known until the shards apply it.
+    size_estimate += 4 + begin.size() + end.size();
+}
+
+//
+// ShardedIterator
+//
+
+ShardedIterator::ShardedIterator(const ShardedWrapper& _parent, std::vector<std::unique_ptr<CDBIteratorBase>> iters)
+    : CDBIteratorBase(_parent),
+    m_iters{std::move(iters)},
+    m_current{m_iters.size()}
+{
+}
+
+void ShardedIterator::SelectSmallest()
+{
+    m_current = m_iters.size();
+    for (size_t i = 0; i < m_iters.size(); i++) {
+        if (!m_iters[i]->Valid()) continue;
+        // MDBX orders keys as unsigned bytes, with a prefix before any longer key.
+        if (m_current == m_iters.size() ||
+            std::ranges::lexicographical_compare(DBRawAccess::Key(*m_iters[i]), DBRawAccess::Key(*m_iters[m_current]))) {
+            m_current = i;
+        }
+    }
+}
+
+void ShardedIterator::SeekImpl(std::span<const std::byte> key)
+{
+    for (auto& iter : m_iters) {
+        DBRawAccess::Seek(*iter, key);
+    }
+    SelectSmallest();
+}
+
+std::span<const std::byte> ShardedIterator::GetKeyImpl() const
+{
+    if (!Valid()) {
+        return {};
+    }
+    return DBRawAccess::Key(*m_iters[m_current]);
+}
+
+std::span<const std::byte> ShardedIterator::GetValueImpl() const
+{
+    if (!Valid()) {
+        return {};
+    }
+    return DBRawAccess::Value(*m_iters[m_current]);
+}
+
+bool ShardedIterator::Valid() const
+{
+    return m_current < m_iters.size();
+}
+
+void ShardedIterator::SeekToFirst()
+{
+    for (auto& iter : m_iters) {
+        iter->SeekToFirst();
+    }
+    SelectSmallest();
+}
+
+void ShardedIterator::Next()
+{
+    // Like MDBXIterator, stepping past the last key is a no-op.
+    if (!Valid()) {
+        return;
+    }
+    // A key lives in exactly one shard, so only the current shard has to move.
+    m_iters[m_current]->Next();
+    SelectSmallest();
+}
+
+//
+// ShardedWrapper
+//
+
+ShardedWrapper::ShardedWrapper(const DBParams& params, size_t shard_count)
+    : CDBWrapperBase(params)
+{
+    assert(shard_count > 0);
+
+    for (size_t i = 0; i < shard_count; i++) {
+        DBParams shard_params{params};
+        shard_params.path = params.path / ("shard_" + std::to_string(i));
+        std::filesystem::create_directories(shard_params.path);
+        m_shards.push_back(std::make_unique<MDBXWrapper>(shard_params));
+    }
+
+    std::vector<uint64_t> shard_epochs;
+    for (const auto& shard : m_shards) {
+        // Shards that were never committed to are at epoch 0.
+        uint64_t epoch{0};
+        const std::optional<std::string> marker{DBRawAccess::Read(*shard, EpochKey())};
+        if (marker) {
+            if (marker->size() != SHARD_EPOCH_SIZE) {
+                throw dbwrapper_error("Malformed shard epoch in " + PathToString(params.path));
+            }
+            uint32_t count;
+            std::memcpy(&epoch, marker->data(), sizeof(epoch));
+            std::memcpy(&count, marker->data() + sizeof(epoch), sizeof(count));
+            if (count != shard_count) {
+                throw dbwrapper_error(PathToString(params.path) + " was created with " + std::to_string(count) +
+                                      " shards, not " + std::to_string(shard_count));
+            }
+        }
+
+        shard_epochs.push_back(epoch);
+        m_epoch = std::max(m_epoch, epoch);
+    }
+
+    if (std::ranges::any_of(shard_epochs, [&](uint64_t epoch) { return epoch != shard_epochs[0]; })) {
+        // Left as found, so the mismatch stays visible on disk until the
+        // caller has replayed the interrupted flush.
+        m_partial_commit = true;
+        std::cout << "Warning: " << m_name << " shards are at different epochs, a previous flush was interrupted, "
+                  << "refusing writes until it is replayed" << std::endl;
+    }
+}
+
+void ShardedWrapper::ClearPartialCommit()
+{
+    m_partial_commit = false;
+}
+
+ShardedWrapper::~ShardedWrapper() = default;
+
+size_t ShardedWrapper::ShardIndex(std::span<const std::byte> key) const
+{
+    // FNV-1a
+    uint64_t hash{0xcbf29ce484222325};
+    for (const std::byte b : key) {
+        hash = (hash ^ std::to_integer<uint64_t>(b)) * 0x100000001b3;
+    }
+    return hash % m_shards.size();
+}
+
+std::optional<std::string> ShardedWrapper::ReadImpl(std::span<const std::byte> key) const
+{
+    return DBRawAccess::Read(*m_shards[ShardIndex(key)], key);
+}
+
+bool ShardedWrapper::ExistsImpl(std::span<const std::byte> key) const
+{
+    return DBRawAccess::Exists(*m_shards[ShardIndex(key)], key);
+}
+
+size_t ShardedWrapper::EstimateSizeImpl(std::span<const std::byte> key1, std::span<const std::byte> key2) const
+{
+    size_t size{0};
+    for (const auto& shard : m_shards) {
+        size += DBRawAccess::EstimateSize(*shard, key1, key2);
+    }
+    return size;
+}
+
+void ShardedWrapper::CommitShard(size_t shard, std::vector<ShardedBatch::ShardOp>& ops, uint64_t epoch, bool fSync)
+{
+    const uint32_t count = m_shards.size();
+    DataStream marker{};
+    WriteLE(marker, epoch);
+    WriteLE(marker, count);
+
+    MDBXBatch shard_batch{*m_shards[shard], /*pause_reader=*/false};
+    for (auto& op : ops) {
+        switch (op.type) {
+        case ShardedBatch::OpType::WRITE:
+            DBRawAccess::Write(shard_batch, op.key, op.value);
+            break;
+        case ShardedBatch::OpType::ERASE:
+            DBRawAccess::Erase(shard_batch, op.key);
+            break;
+        case ShardedBatch::OpType::ERASE_RANGE:
+            DBRawAccess::EraseRange(shard_batch, op.key, op.value);
+            break;
+        }
+    }
+    DBRawAccess::Write(shard_batch, EpochKey(), marker);
+    m_shards[shard]->WriteBatch(shard_batch, fSync);
+}
+
+bool ShardedWrapper::WriteBatch(CDBBatchBase& _batch, bool fSync)
+{
+    ShardedBatch& batch = static_cast<ShardedBatch&>(_batch);
+    if (m_partial_commit) {
+        throw dbwrapper_error("Refusing to write to " + m_name + ", its shards are at different epochs");
+    }
+    const uint64_t epoch{m_epoch + 1};
+
+    // MDBX write txns belong to the thread that started them, so each shard's
+    // txn is built and committed entirely on its own thread.
+    std::vector<std::exception_ptr> errors(m_shards.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < m_shards.size(); i++) {
+        workers.emplace_back([&, i] {
+            try {
+                CommitShard(i, batch.m_ops[i], epoch, fSync);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (auto& shard : m_shards) {
+        shard->RenewReader();
+    }
+    for (auto& ops : batch.m_ops) {
+        ops.clear();
+    }
+
+    // Even when some shards failed, the next commit must be above every
+    // epoch that reached the disk.
+    m_epoch = epoch;
+    for (const auto& error : errors) {
+        if (error) {
+            m_partial_commit = true;
+            std::rethrow_exception(error);
+        }
+    }
+    return true;
+}
+
+size_t ShardedWrapper::DynamicMemoryUsage() const
+{
+    size_t usage{0};
+    for (const auto& shard : m_shards) {
+        usage += shard->DynamicMemoryUsage();
+    }
+    return usage;
+}
+
+CDBIteratorBase* ShardedWrapper::NewIterator()
+{
+    std::vector<std::unique_ptr<CDBIteratorBase>> iters;
+    for (auto& shard : m_shards) {
+        iters.emplace_back(shard->NewIterator());
+    }
+    return new ShardedIterator{*this, std::move(iters)};
+}
+
+bool ShardedWrapper::IsEmpty()
+{
+    return std::ranges::all_of(m_shards, [](const auto& shard) { return shard->IsEmpty(); });
+}
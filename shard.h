@@ -0,0 +1,129 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "dbwrapper.h"
+#include "mdbx.h"
+
+class ShardedWrapper;
+
+/**
+ * Batch of changes for a ShardedWrapper. Changes are buffered per shard, and
+ * only turned into MDBX write txns by WriteBatch, on one thread per shard.
+ */
+class ShardedBatch : public CDBBatchBase
+{
+    friend class ShardedWrapper;
+
+private:
+    enum class OpType { WRITE, ERASE, ERASE_RANGE };
+    struct ShardOp {
+        OpType type;
+        std::vector<std::byte> key;
+        //! The value to write, or the end key of a range erase.
+        DataStream value;
+    };
+    std::vector<std::vector<ShardOp>> m_ops;
+
+    void WriteImpl(std::span<const std::byte> key, DataStream& ssValue) override;
+    void EraseImpl(std::span<const std::byte> key) override;
+    //! Every shard may hold keys in the range, so it is queued for all of them.
+    void EraseRangeImpl(std::span<const std::byte> begin, std::span<const std::byte> end) override;
+
+public:
+    /**
+     * @param[in] _parent   ShardedWrapper that this batch is to be submitted to
+     */
+    explicit ShardedBatch(const ShardedWrapper& _parent);
+    void Clear() override;
+};
+
+/** Iterator that merges the shards back into a single ordered keyspace */
+class ShardedIterator : public CDBIteratorBase
+{
+private:
+    std::vector<std::unique_ptr<CDBIteratorBase>> m_iters;
+    //! Index of the shard iterator holding the smallest key, or m_iters.size().
+    size_t m_current;
+
+    //! Point m_current at the valid shard iterator with the smallest key.
+    void SelectSmallest();
+
+    void SeekImpl(std::span<const std::byte> key) override;
+    std::span<const std::byte> GetKeyImpl() const override;
+    std::span<const std::byte> GetValueImpl() const override;
+
+public:
+    ShardedIterator(const ShardedWrapper& _parent, std::vector<std::unique_ptr<CDBIteratorBase>> iters);
+
+    bool Valid() const override;
+    void SeekToFirst() override;
+    void Next() override;
+};
+
+/**
+ * Hash-partitions keys over several MDBX environments, each with its own file
+ * and writer lock, so that batches are committed by all shards in parallel.
+ *
+ * Each shard commits its part of a batch together with the batch's epoch.
+ * Shards are not committed atomically with each other: if a commit is
+ * interrupted part way, the shards are found on different epochs when the
+ * database is reopened. This is reported by HasPartialCommit(), and writes are
+ * refused until the caller has acknowledged it with ClearPartialCommit(). As
+ * with Bitcoin Core's DB_HEAD_BLOCKS, recovery is left to the caller, who
+ * replays the interrupted flush; that commit brings every shard to the same
+ * epoch again.
+ */
+class ShardedWrapper : public CDBWrapperBase
+{
+    friend class ShardedBatch;
+
+private:
+    std::vector<std::unique_ptr<MDBXWrapper>> m_shards;
+    //! Epoch of the last commit.
+    uint64_t m_epoch{0};
+    bool m_partial_commit{false};
+
+    size_t ShardIndex(std::span<const std::byte> key) const;
+
+    //! Commit one shard's part of a batch, with the epoch marker, on the calling thread.
+    void CommitShard(size_t shard, std::vector<ShardedBatch::ShardOp>& ops, uint64_t epoch, bool fSync);
+
+    std::optional<std::string> ReadImpl(std::span<const std::byte> key) const override;
+    bool ExistsImpl(std::span<const std::byte> key) const override;
+    size_t EstimateSizeImpl(std::span<const std::byte> key1, std::span<const std::byte> key2) const override;
+
+    inline std::unique_ptr<CDBBatchBase> CreateBatch() const override {
+        return std::make_unique<ShardedBatch>(*this);
+    }
+
+public:
+    /**
+     * @param[in] params        Shards are stored in shard_<n> directories under params.path,
+     *                          the remaining params are passed on to every shard.
+     * @param[in] shard_count   Number of shards, must match the count the database was created with.
+     */
+    ShardedWrapper(const DBParams& params, size_t shard_count);
+    ~ShardedWrapper() override;
+
+    bool WriteBatch(CDBBatchBase& batch, bool fSync) override;
+
+    size_t DynamicMemoryUsage() const override;
+
+    CDBIteratorBase* NewIterator() override;
+
+    bool IsEmpty() override;
+
+    //! Return true if the shards are on different epochs, or a commit failed
+    //! part way. Writes are refused then.
+    bool HasPartialCommit() const { return m_partial_commit; }
+
+    //! Allow writes again, once the caller is about to replay the interrupted flush.
+    void ClearPartialCommit();
+};
+
+#endif // SHARD_H
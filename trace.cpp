@@ -0,0 +1,433 @@
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "dbwrapper.h"
+#include "trace.h"
+
+using steady_clock = std::chrono::steady_clock;
+
+// Records and their key bytes are padded to this alignment.
+static constexpr size_t TRACE_ALIGN{8};
+
+static size_t TracePadded(size_t size)
+{
+    return (size + TRACE_ALIGN - 1) & ~(TRACE_ALIGN - 1);
+}
+
+TraceWriter::TraceWriter(const std::filesystem::path& path)
+    : m_file{std::fopen(path.c_str(), "wb")},
+    m_path{path},
+    m_start{steady_clock::now()}
+{
+    if (!m_file) {
+        throw dbwrapper_error("Failed to open trace file: " + PathToString(path));
+    }
+    // Let the stream batch records into large writes.
+    std::setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+
+    TraceHeader header{};
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    std::fwrite(&header, sizeof(header), 1, m_file);
+}
+
+TraceWriter::~TraceWriter()
+{
+    if (m_file && (std::ferror(m_file) || std::fclose(m_file) != 0)) {
+        std::cout << "Warning: trace file " << PathToString(m_path) << " is incomplete" << std::endl;
+    }
+}
+
+void TraceWriter::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file || std::fflush(m_file) != 0 || std::ferror(m_file)) {
+        throw dbwrapper_error("Failed to write trace file: " + PathToString(m_path));
+    }
+}
+
+void TraceWriter::Close()
+{
+    Flush();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const int ret{std::fclose(m_file)};
+    m_file = nullptr;
+    if (ret != 0) {
+        throw dbwrapper_error("Failed to write trace file: " + PathToString(m_path));
+    }
+}
+
+void TraceWriter::Append(TraceOp op, uint8_t flags, uint32_t handle, std::span<const std::byte> key,
+                         size_t value_size, steady_clock::time_point start)
+{
+    const auto end{steady_clock::now()};
+
+    TraceRecord record{};
+    record.op = op;
+    record.flags = flags;
+    record.handle = handle;
+    record.key_size = key.size();
+    record.value_size = value_size;
+    record.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_start).count();
+    record.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    static constexpr std::byte padding[TRACE_ALIGN]{};
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file) {
+        return;
+    }
+    std::fwrite(&record, sizeof(record), 1, m_file);
+    std::fwrite(key.data(), 1, key.size(), m_file);
+    std::fwrite(padding, 1, TracePadded(key.size()) - key.size(), m_file);
+}
+
+//
+// TracingBatch
+//
+
+TracingBatch::TracingBatch(const TracingWrapper& _parent, TraceWriter& trace, uint32_t handle, std::unique_ptr<CDBBatchBase> inner)
+    : CDBBatchBase(_parent),
+    m_trace{trace},
+    m_handle{handle},
+    m_inner{std::move(inner)}
+{
+}
+
+TracingBatch::~TracingBatch()
+{
+    m_trace.Append(TraceOp::BATCH_DESTROY, 0, m_handle, {}, 0, steady_clock::now());
+}
+
+void TracingBatch::WriteImpl(std::span<const std::byte> key, DataStream& ssValue)
+{
+    const size_t value_size{ssValue.size()};
+    const auto start{steady_clock::now()};
+    DBRawAccess::Write(*m_inner, key, ssValue);
+    m_trace.Append(TraceOp::BATCH_WRITE, 0, m_handle, key, value_size, start);
+    size_estimate = m_inner->SizeEstimate();
+}
+
+void TracingBatch::EraseImpl(std::span<const std::byte> key)
+{
+    const auto start{steady_clock::now()};
+    DBRawAccess::Erase(*m_inner, key);
+    m_trace.Append(TraceOp::BATCH_ERASE, 0, m_handle, key, 0, start);
+    size_estimate = m_inner->SizeEstimate();
+}
+
+void TracingBatch::EraseRangeImpl(std::span<const std::byte> begin, std::span<const std::byte> end)
+{
+    std::vector<std::byte> range{begin.begin(), begin.end()};
+    range.insert(range.end(), end.begin(), end.end());
+
+    const auto start{steady_clock::now()};
+    DBRawAccess::EraseRange(*m_inner, begin, end);
+    m_trace.Append(TraceOp::BATCH_ERASE_RANGE, 0, m_handle, range, end.size(), start);
+    size_estimate = m_inner->SizeEstimate();
+}
+
+void TracingBatch::Clear()
+{
+    const auto start{steady_clock::now()};
+    m_inner->Clear();
+    m_trace.Append(TraceOp::BATCH_CLEAR, 0, m_handle, {}, 0, start);
+    size_estimate = m_inner->SizeEstimate();
+}
+
+//
+// TracingIterator
+//
+
+TracingIterator::TracingIterator(const TracingWrapper& _parent, TraceWriter& trace, uint32_t handle, std::unique_ptr<CDBIteratorBase> inner)
+    : CDBIteratorBase(_parent),
+    m_trace{trace},
+    m_handle{handle},
+    m_inner{std::move(inner)}
+{
+}
+
+TracingIterator::~TracingIterator()
+{
+    m_trace.Append(TraceOp::ITER_DESTROY, 0, m_handle, {}, 0, steady_clock::now());
+}
+
+void TracingIterator::SeekImpl(std::span<const std::byte> key)
+{
+    const auto start{steady_clock::now()};
+    DBRawAccess::Seek(*m_inner, key);
+    m_trace.Append(TraceOp::ITER_SEEK, m_inner->Valid() ? TRACE_FLAG_HIT : 0, m_handle, key, 0, start);
+}
+
+std::span<const std::byte> TracingIterator::GetKeyImpl() const
+{
+    return DBRawAccess::Key(*m_inner);
+}
+
+std::span<const std::byte> TracingIterator::GetValueImpl() const
+{
+    return DBRawAccess::Value(*m_inner);
+}
+
+bool TracingIterator::Valid() const
+{
+    return m_inner->Valid();
+}
+
+void TracingIterator::SeekToFirst()
+{
+    const auto start{steady_clock::now()};
+    m_inner->SeekToFirst();
+    m_trace.Append(TraceOp::ITER_SEEK_TO_FIRST, m_inner->Valid() ? TRACE_FLAG_HIT : 0, m_handle, {}, 0, start);
+}
+
+void TracingIterator::Next()
+{
+    const auto start{steady_clock::now()};
+    m_inner->Next();
+    m_trace.Append(TraceOp::ITER_NEXT, m_inner->Valid() ? TRACE_FLAG_HIT : 0, m_handle, {}, 0, start);
+}
+
+//
+// TracingWrapper
+//
+
+static DBParams TracedParams(CDBWrapperBase& inner)
+{
+    const auto path{inner.StoragePath()};
+    return DBParams{.path = path.value_or(std::filesystem::path{}), .cache_bytes = 0, .memory_only = !path};
+}
+
+TracingWrapper::TracingWrapper(CDBWrapperBase& inner, const std::filesystem::path& trace_path)
+    : CDBWrapperBase(TracedParams(inner)),
+    m_inner{inner},
+    m_trace{trace_path}
+{
+}
+
+TracingWrapper::~TracingWrapper() = default;
+
+std::optional<std::string> TracingWrapper::ReadImpl(std::span<const std::byte> key) const
+{
+    const auto start{steady_clock::now()};
+    std::optional<std::string> value{DBRawAccess::Read(m_inner, key)};
+    m_trace.Append(TraceOp::READ, value ? TRACE_FLAG_HIT : 0, 0, key, value ? value->size() : 0, start);
+    return value;
+}
+
+bool TracingWrapper::ExistsImpl(std::span<const std::byte> key) const
+{
+    const auto start{steady_clock::now()};
+    const bool exists{DBRawAccess::Exists(m_inner, key)};
+    m_trace.Append(TraceOp::EXISTS, exists ? TRACE_FLAG_HIT : 0, 0, key, 0, start);
+    return exists;
+}
+
+size_t TracingWrapper::EstimateSizeImpl(std::span<const std::byte> key1, std::span<const std::byte> key2) const
+{
+    return DBRawAccess::EstimateSize(m_inner, key1, key2);
+}
+
+std::unique_ptr<CDBBatchBase> TracingWrapper::CreateBatch() const
+{
+    const uint32_t handle{m_next_handle++};
+    const auto start{steady_clock::now()};
+    auto inner{DBRawAccess::CreateBatch(m_inner)};
+    m_trace.Append(TraceOp::BATCH_CREATE, 0, handle, {}, 0, start);
+    return std::make_unique<TracingBatch>(*this, m_trace, handle, std::move(inner));
+}
+
+bool TracingWrapper::WriteBatch(CDBBatchBase& _batch, bool fSync)
+{
+    TracingBatch& batch = static_cast<TracingBatch&>(_batch);
+    const auto start{steady_clock::now()};
+    const bool ret{m_inner.WriteBatch(*batch.m_inner, fSync)};
+    m_trace.Append(TraceOp::WRITE_BATCH, fSync ? TRACE_FLAG_SYNC : 0, batch.m_handle, {}, 0, start);
+    if (fSync) {
+        m_trace.Flush();
+    }
+    return ret;
+}
+
+size_t TracingWrapper::DynamicMemoryUsage() const
+{
+    return m_inner.DynamicMemoryUsage();
+}
+
+CDBIteratorBase* TracingWrapper::NewIterator()
+{
+    const uint32_t handle{m_next_handle++};
+    const auto start{steady_clock::now()};
+    std::unique_ptr<CDBIteratorBase> inner{m_inner.NewIterator()};
+    m_trace.Append(TraceOp::ITER_CREATE, 0, handle, {}, 0, start);
+    return new TracingIterator{*this, m_trace, handle, std::move(inner)};
+}
+
+bool TracingWrapper::IsEmpty()
+{
+    return m_inner.IsEmpty();
+}
+
+//
+// TraceReader
+//
+
+TraceReader::TraceReader(const std::filesystem::path& path)
+{
+    const int fd{open(path.c_str(), O_RDONLY)};
+    if (fd < 0) {
+        throw dbwrapper_error("Failed to open trace file: " + PathToString(path));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TraceHeader)) {
+        close(fd);
+        throw dbwrapper_error("Trace file is truncated: " + PathToString(path));
+    }
+    m_size = st.st_size;
+
+    void* map{mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    close(fd);
+    if (map == MAP_FAILED) {
+        throw dbwrapper_error("Failed to map trace file: " + PathToString(path));
+    }
+    m_data = static_cast<const std::byte*>(map);
+    madvise(map, m_size, MADV_SEQUENTIAL);
+
+    TraceHeader header;
+    std::memcpy(&header, m_data, sizeof(header));
+    if (std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION) {
+        munmap(map, m_size);
+        throw dbwrapper_error("Not a version " + std::to_string(TRACE_VERSION) + " trace file: " + PathToString(path));
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    munmap(const_cast<std::byte*>(m_data), m_size);
+}
+
+bool TraceReader::Next(size_t& pos, TraceRecord& record, std::span<const std::byte>& key) const
+{
+    if (pos == 0) {
+        pos = sizeof(TraceHeader);
+    }
+    // A trace cut short while recording ends at its last complete record.
+    if (pos + sizeof(TraceRecord) > m_size) {
+        if (pos < m_size) {
+            std::cout << "Warning: trace ends with a partial record" << std::endl;
+        }
+        return false;
+    }
+    std::memcpy(&record, m_data + pos, sizeof(record));
+    if (pos + sizeof(TraceRecord) + record.key_size > m_size) {
+        std::cout << "Warning: trace ends with a partial record" << std::endl;
+        return false;
+    }
+
+    key = std::span<const std::byte>{m_data + pos + sizeof(TraceRecord), record.key_size};
+    pos += sizeof(TraceRecord) + TracePadded(record.key_size);
+    return true;
+}
+
+//
+// Replay
+//
+
+ReplayStats ReplayTrace(const TraceReader& trace, CDBWrapperBase& db, bool paced)
+{
+    std::unordered_map<uint32_t, std::unique_ptr<CDBBatchBase>> batches;
+    std::unordered_map<uint32_t, std::unique_ptr<CDBIteratorBase>> iterators;
+
+    auto batch = [&](uint32_t handle) -> CDBBatchBase& {
+        auto it{batches.find(handle)};
+        if (it == batches.end()) {
+            throw dbwrapper_error("Trace refers to unknown batch " + std::to_string(handle));
+        }
+        return *it->second;
+    };
+    auto iterator = [&](uint32_t handle) -> CDBIteratorBase& {
+        auto it{iterators.find(handle)};
+        if (it == iterators.end()) {
+            throw dbwrapper_error("Trace refers to unknown iterator " + std::to_string(handle));
+        }
+        return *it->second;
+    };
+
+    ReplayStats stats;
+    DataStream ssValue{};
+    const auto start{steady_clock::now()};
+
+    size_t pos{0};
+    TraceRecord record;
+    std::span<const std::byte> key;
+    while (trace.Next(pos, record, key)) {
+        if (paced) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds{record.start_ns});
+        }
+        const bool hit{(record.flags & TRACE_FLAG_HIT) != 0};
+
+        switch (record.op) {
+        case TraceOp::READ:
+            stats.divergent += DBRawAccess::Read(db, key).has_value() != hit;
+            break;
+        case TraceOp::EXISTS:
+            stats.divergent += DBRawAccess::Exists(db, key) != hit;
+            break;
+        case TraceOp::BATCH_CREATE:
+            batches[record.handle] = DBRawAccess::CreateBatch(db);
+            break;
+        case TraceOp::BATCH_WRITE:
+            ssValue.clear();
+            ssValue.resize(record.value_size, std::byte{0x5a});
+            DBRawAccess::Write(batch(record.handle), key, ssValue);
+            break;
+        case TraceOp::BATCH_ERASE:
+            DBRawAccess::Erase(batch(record.handle), key);
+            break;
+        case TraceOp::BATCH_ERASE_RANGE:
+            if (record.value_size > key.size()) {
+                throw dbwrapper_error("Malformed range erase in trace");
+            }
+            DBRawAccess::EraseRange(batch(record.handle), key.first(key.size() - record.value_size), key.last(record.value_size));
+            break;
+        case TraceOp::BATCH_CLEAR:
+            batch(record.handle).Clear();
+            break;
+        case TraceOp::BATCH_DESTROY:
+            batches.erase(record.handle);
+            break;
+        case TraceOp::WRITE_BATCH:
+            db.WriteBatch(batch(record.handle), (record.flags & TRACE_FLAG_SYNC) != 0);
+            break;
+        case TraceOp::ITER_CREATE:
+            iterators[record.handle].reset(db.NewIterator());
+            break;
+        case TraceOp::ITER_SEEK:
+            DBRawAccess::Seek(iterator(record.handle), key);
+            break;
+        case TraceOp::ITER_SEEK_TO_FIRST:
+            iterator(record.handle).SeekToFirst();
+            break;
+        case TraceOp::ITER_NEXT:
+            iterator(record.handle).Next();
+            break;
+        case TraceOp::ITER_DESTROY:
+            iterators.erase(record.handle);
+            break;
+        default:
+            throw dbwrapper_error("Unknown trace operation " + std::to_string(static_cast<int>(record.op)));
+        }
+        ++stats.ops;
+    }
+
+    stats.elapsed = steady_clock::now() - start;
+    return stats;
+}
@@ -0,0 +1,222 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "dbwrapper.h"
+
+// A trace is a TraceHeader followed by a stream of records. Each record is a
+// fixed TraceRecord followed by its key bytes, padded to a multiple of 8 bytes,
+// so a trace can be appended to while recording and walked in place once it
+// has been mapped into memory. Fields are stored in native (little) endian.
+
+static_assert(std::endian::native == std::endian::little, "trace format assumes a little-endian host");
+
+static constexpr char TRACE_MAGIC[8] = {'d', 'b', 't', 'r', 'a', 'c', 'e', '\0'};
+static constexpr uint32_t TRACE_VERSION{1};
+
+enum class TraceOp : uint8_t {
+    READ = 1,
+    EXISTS,
+    BATCH_CREATE,
+    BATCH_WRITE,
+    BATCH_ERASE,
+    BATCH_CLEAR,
+    BATCH_DESTROY,
+    WRITE_BATCH,
+    ITER_CREATE,
+    ITER_SEEK,
+    ITER_SEEK_TO_FIRST,
+    ITER_NEXT,
+    ITER_DESTROY,
+    //! The key bytes hold the begin key followed by the end key, and
+    //! value_size is the length of the end key.
+    BATCH_ERASE_RANGE,
+};
+
+//! Set on READ and EXISTS hits, and on ITER_* moves that left the iterator valid.
+static constexpr uint8_t TRACE_FLAG_HIT{1 << 0};
+//! Set on WRITE_BATCH when the batch was written with fSync.
+static constexpr uint8_t TRACE_FLAG_SYNC{1 << 1};
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+static_assert(sizeof(TraceHeader) == 16);
+
+struct TraceRecord {
+    TraceOp op;
+    uint8_t flags;
+    uint16_t reserved;
+    //! Batch or iterator the operation applies to, 0 for wrapper operations.
+    uint32_t handle;
+    uint32_t key_size;
+    uint32_t value_size;
+    //! Nanoseconds between the start of the trace and the start of the operation.
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+static_assert(sizeof(TraceRecord) == 32);
+
+//! Appends records to a trace file through a buffered stream.
+class TraceWriter
+{
+private:
+    std::FILE* m_file;
+    const std::filesystem::path m_path;
+    std::mutex m_mutex;
+    const std::chrono::steady_clock::time_point m_start;
+
+public:
+    explicit TraceWriter(const std::filesystem::path& path);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    //! Record an operation that began at `start` and has just finished.
+    //! Write errors are left on the stream and reported by Flush() or Close().
+    void Append(TraceOp op, uint8_t flags, uint32_t handle, std::span<const std::byte> key,
+                size_t value_size, std::chrono::steady_clock::time_point start);
+
+    //! Push buffered records to the file, throwing if any record was lost.
+    void Flush();
+    //! Flush and close the file, throwing if the trace is incomplete.
+    void Close();
+};
+
+class TracingWrapper;
+
+/** Batch that records every change before handing it to the traced backend */
+class TracingBatch : public CDBBatchBase
+{
+    friend class TracingWrapper;
+
+private:
+    TraceWriter& m_trace;
+    const uint32_t m_handle;
+    const std::unique_ptr<CDBBatchBase> m_inner;
+
+    void WriteImpl(std::span<const std::byte> key, DataStream& ssValue) override;
+    void EraseImpl(std::span<const std::byte> key) override;
+    void EraseRangeImpl(std::span<const std::byte> begin, std::span<const std::byte> end) override;
+
+public:
+    TracingBatch(const TracingWrapper& _parent, TraceWriter& trace, uint32_t handle, std::unique_ptr<CDBBatchBase> inner);
+    ~TracingBatch() override;
+    void Clear() override;
+};
+
+/** Iterator that records seeks and scans over the traced backend */
+class TracingIterator : public CDBIteratorBase
+{
+private:
+    TraceWriter& m_trace;
+    const uint32_t m_handle;
+    const std::unique_ptr<CDBIteratorBase> m_inner;
+
+    void SeekImpl(std::span<const std::byte> key) override;
+    std::span<const std::byte> GetKeyImpl() const override;
+    std::span<const std::byte> GetValueImpl() const override;
+
+public:
+    TracingIterator(const TracingWrapper& _parent, TraceWriter& trace, uint32_t handle, std::unique_ptr<CDBIteratorBase> inner);
+    ~TracingIterator() override;
+
+    bool Valid() const override;
+    void SeekToFirst() override;
+    void Next() override;
+};
+
+/**
+ * Forwards every operation to another CDBWrapperBase, recording it with its
+ * key, value size and timing so that the traffic can be replayed later.
+ */
+class TracingWrapper : public CDBWrapperBase
+{
+private:
+    CDBWrapperBase& m_inner;
+    mutable TraceWriter m_trace;
+    mutable std::atomic<uint32_t> m_next_handle{1};
+
+    std::optional<std::string> ReadImpl(std::span<const std::byte> key) const override;
+    bool ExistsImpl(std::span<const std::byte> key) const override;
+    size_t EstimateSizeImpl(std::span<const std::byte> key1, std::span<const std::byte> key2) const override;
+
+    std::unique_ptr<CDBBatchBase> CreateBatch() const override;
+
+public:
+    /**
+     * @param[in] inner         Backend that all operations are forwarded to.
+     * @param[in] trace_path    File the trace is written to, replacing any existing one.
+     */
+    TracingWrapper(CDBWrapperBase& inner, const std::filesystem::path& trace_path);
+    ~TracingWrapper() override;
+
+    //! Also flushes the trace when fSync is set.
+    bool WriteBatch(CDBBatchBase& batch, bool fSync) override;
+
+    size_t DynamicMemoryUsage() const override;
+
+    CDBIteratorBase* NewIterator() override;
+
+    bool IsEmpty() override;
+
+    //! Finish the trace, throwing if any of it could not be written.
+    void CloseTrace() { m_trace.Close(); }
+};
+
+/** Read-only view of a trace file, mapped into memory */
+class TraceReader
+{
+private:
+    const std::byte* m_data{nullptr};
+    size_t m_size{0};
+
+public:
+    explicit TraceReader(const std::filesystem::path& path);
+    ~TraceReader();
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    /**
+     * Step through the trace.
+     *
+     * @param[in,out] pos       Offset of the next record, start from 0.
+     * @param[out]    record    The record at pos.
+     * @param[out]    key       Key bytes of the record, pointing into the mapping.
+     * @returns false once the end of the trace is reached.
+     */
+    bool Next(size_t& pos, TraceRecord& record, std::span<const std::byte>& key) const;
+};
+
+struct ReplayStats {
+    uint64_t ops{0};
+    //! READ/EXISTS results that differ from the recorded ones.
+    uint64_t divergent{0};
+    std::chrono::nanoseconds elapsed{0};
+};
+
+/**
+ * Drive a backend with the operations in a trace. Written values are filled
+ * to their recorded size.
+ *
+ * @param[in] paced     If true, wait until each operation's original start time,
+ *                      otherwise issue operations back to back.
+ */
+ReplayStats ReplayTrace(const TraceReader& trace, CDBWrapperBase& db, bool paced);
+
+#endif // TRACE_H